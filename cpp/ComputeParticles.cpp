@@ -0,0 +1,221 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <cstring>
+
+#include "../h/ComputeParticles.h"
+
+ComputeParticles::~ComputeParticles() {
+	glDeleteBuffers(BUFFERS::COUNT, this->buffers);
+}
+
+bool ComputeParticles::supported() {
+	return GLEW_VERSION_4_3 || GLEW_ARB_compute_shader;
+}
+
+ComputeParticles& ComputeParticles::init(const Particles& ps) {
+	// Keep the settings, the CPU pool and kernels are not used here
+	this->config.pos = ps.pos;
+	this->config.gravity = ps.gravity;
+	this->config.maxSpeedX = ps.maxSpeedX;
+	this->config.minSpeedY = ps.minSpeedY;
+	this->config.maxSpeedY = ps.maxSpeedY;
+	this->config.edge = ps.edge;
+	this->config.color = ps.color;
+	this->config.seed = ps.seed;
+
+	this->numParticles = ps.store.size();
+	this->tick = 0;
+
+	this->compileShaders();
+
+	glGenBuffers(BUFFERS::COUNT, this->buffers);
+
+	// Start from the state the CPU initialized
+	this->upload(ps.store);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->buffers[BUFFERS::RESET]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, this->numParticles * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+	// The renderer reads this one as per instance vertex attributes
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->buffers[BUFFERS::INSTANCES]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, this->numParticles * sizeof(ParticleInstance), nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	return *this;
+}
+
+/**********************************************
+*
+*				OpenGL
+*
+***********************************************/
+ComputeParticles& ComputeParticles::compileShaders() {
+	TRACE_ZONE("ComputeParticles::compileShaders");
+
+	this->update = GLProgramCache::shared().get({
+	    {GL_COMPUTE_SHADER, "glsl/update.comp"}
+	});
+	this->interpolation = GLProgramCache::shared().get({
+	    {GL_COMPUTE_SHADER, "glsl/interpolate.comp"}
+	});
+	this->uniform.clear();
+
+	return *this;
+}
+ComputeParticles& ComputeParticles::upload(const ParticleStore& store) {
+	TRACE_ZONE("ComputeParticles::upload");
+
+	const ParticleStore::FloatArray* arrays[] = {
+		&store.posX, &store.posY, &store.prevX, &store.prevY,
+		&store.velX, &store.velY, &store.speedX, &store.speedY,
+		&store.radius
+	};
+
+	for (int b = BUFFERS::POS_X; b <= BUFFERS::RADIUS; b++)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->buffers[b]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, store.size() * sizeof(float),
+			arrays[b]->data(), GL_DYNAMIC_COPY);
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	return *this;
+}
+ComputeParticles& ComputeParticles::download(ParticleStore& store, std::vector< std::uint8_t >& reset) {
+	TRACE_ZONE("ComputeParticles::download");
+
+	ParticleStore::FloatArray* arrays[] = {
+		&store.posX, &store.posY, &store.prevX, &store.prevY,
+		&store.velX, &store.velY, &store.speedX, &store.speedY,
+		&store.radius
+	};
+
+	// Make the compute shader writes visible to the reads below
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	store.resize(this->numParticles);
+
+	for (int b = BUFFERS::POS_X; b <= BUFFERS::RADIUS; b++)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->buffers[b]);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, this->numParticles * sizeof(float),
+			arrays[b]->data());
+	}
+
+	std::vector< GLuint > flags(this->numParticles);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->buffers[BUFFERS::RESET]);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, flags.size() * sizeof(GLuint), flags.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	reset.assign(flags.begin(), flags.end());
+
+	return *this;
+}
+GLuint ComputeParticles::instanceBuffer() const {
+	return this->buffers[BUFFERS::INSTANCES];
+}
+GLint ComputeParticles::location(GLProgram& prg, const std::string& name) {
+	// Look each uniform up once per program
+	const std::string key = std::to_string(prg.program()) + name;
+
+	auto found = this->uniform.find(key);
+	if (found != this->uniform.end())
+		return found->second;
+
+	return this->uniform[key] = glGetUniformLocation(prg.program(), name.c_str());
+}
+ComputeParticles& ComputeParticles::bindBuffers() {
+	// The binding points match the layout(binding = n) in the shaders
+	for (GLuint b = 0; b < BUFFERS::COUNT; b++)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, this->buffers[b]);
+
+	return *this;
+}
+ComputeParticles& ComputeParticles::dispatch() {
+	// 256 particles per work group, see local_size_x in the shaders
+	const GLuint groups = (this->numParticles + 255) / 256;
+
+	if (groups > 0)
+		glDispatchCompute(groups, 1, 1);
+
+	return *this;
+}
+
+/**********************************************
+*
+*				Logic
+*
+***********************************************/
+ComputeParticles& ComputeParticles::updatePosition(const float& dt) {
+	TRACE_ZONE("ComputeParticles::updatePosition");
+
+	GLProgram& prg = this->update;
+	const EdgeParams& edge = this->config.edge;
+
+	prg.program_start();
+	this->bindBuffers();
+
+	glUniform1ui(this->location(prg, "count"), this->numParticles);
+	glUniform1f(this->location(prg, "dt"), dt);
+	glUniform1f(this->location(prg, "gravityStep"), this->config.gravity * dt);
+	glUniform1ui(this->location(prg, "seed"), this->config.seed);
+	glUniform1ui(this->location(prg, "tick"), this->tick++);
+	glUniform2f(this->location(prg, "emitter"), this->config.pos.x, this->config.pos.y);
+	glUniform1i(this->location(prg, "maxSpeedX"), this->config.maxSpeedX);
+	glUniform1i(this->location(prg, "minSpeedY"), this->config.minSpeedY);
+	glUniform1i(this->location(prg, "maxSpeedY"), this->config.maxSpeedY);
+	glUniform1f(this->location(prg, "edgeFloor"), edge.floor);
+	glUniform1f(this->location(prg, "edgeLeft"), edge.left);
+	glUniform1f(this->location(prg, "edgeRight"), edge.right);
+	glUniform1f(this->location(prg, "edgeBounce"), edge.bounce);
+	glUniform1f(this->location(prg, "edgeFriction"), edge.friction);
+	glUniform1f(this->location(prg, "edgeSlow"), edge.slow);
+
+	this->dispatch();
+
+	// The next dispatch reads what this one wrote
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	prg.program_stop();
+
+	return *this;
+}
+ComputeParticles& ComputeParticles::interpolate(const float& dt, const float& ip) {
+	TRACE_ZONE("ComputeParticles::interpolate");
+
+	GLProgram& prg = this->interpolation;
+
+	prg.program_start();
+	this->bindBuffers();
+
+	glUniform1ui(this->location(prg, "count"), this->numParticles);
+	glUniform1f(this->location(prg, "stepTime"), dt * ip);
+	glUniform1ui(this->location(prg, "color"), this->config.color);
+
+	this->dispatch();
+
+	// The instances are read as vertex attributes by the next draw
+	glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+	prg.program_stop();
+
+	return *this;
+}
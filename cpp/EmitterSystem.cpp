@@ -0,0 +1,327 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <limits>
+
+#include "../h/EmitterSystem.h"
+
+EmitterSystem& EmitterSystem::init() {
+	// The only allocations, emitting and dying reuse the slots
+	this->store.reserve(this->numParticles);
+	this->reset.assign(this->numParticles, 0);
+	this->emitted.assign(this->list.size(), 0.0f);
+	this->chunk = std::max< std::size_t >(1, this->chunkSize);
+	this->chunkLive.assign((this->numParticles + this->chunk - 1) / this->chunk, 0);
+
+	// Keep the seed we picked so the run can be recorded and repeated
+	if (this->seed == 0)
+		this->seed = static_cast<std::uint32_t>(std::time(0));
+
+	this->startSeed = this->seed;
+	this->morton.rewind();
+
+	for (std::size_t e = 0; e < this->list.size(); e++)
+		this->seedEmitter(e);
+
+	return *this;
+}
+EmitterSystem& EmitterSystem::seedEmitter(const std::size_t& e) {
+	const Emitter& em = this->list[e];
+
+	// An emitter with its own seed gets the same particles in any system
+	if (em.seed)
+		this->rng[e].seed(em.seed);
+	else
+		this->rng[e].seed(this->startSeed, e);
+
+	return *this;
+}
+std::size_t EmitterSystem::add(const Emitter& e) {
+	if (this->list.size() >= maxEmitters)
+		return noEmitter;
+
+	this->list.push_back(e);
+	this->gravityStep.push_back(0.0f);
+	this->materialOf.push_back(e.material);
+	this->emitted.push_back(0.0f);
+	this->rng.emplace_back();
+
+	// Added after init()
+	if (this->startSeed)
+		this->seedEmitter(this->list.size() - 1);
+
+	return this->list.size() - 1;
+}
+const std::vector< Emitter >& EmitterSystem::emitters() const {
+	return this->list;
+}
+EmitterSystem& EmitterSystem::set(const std::size_t& e, const Emitter& em) {
+	const bool reseed = em.seed != this->list[e].seed;
+
+	this->list[e] = em;
+	this->materialOf[e] = em.material;
+
+	// Only once init() has picked the system's seed
+	if (reseed && this->startSeed)
+		this->seedEmitter(e);
+
+	return *this;
+}
+std::size_t EmitterSystem::materials() const {
+	std::size_t count = 1;
+
+	for (const auto& m : this->materialOf)
+		count = std::max< std::size_t >(count, m + 1);
+
+	return count;
+}
+const std::vector< std::size_t >& EmitterSystem::ranges() const {
+	return this->materialStart;
+}
+/**
+ * Emit count particles from emitter e, as many as there are free slots for
+ * @param e
+ * @param count
+ */
+EmitterSystem& EmitterSystem::burst(const std::size_t& e, const std::size_t& count) {
+	const Emitter& em = this->list[e];
+	Random& rng = this->rng[e];
+	ParticleStore& s = this->store;
+
+	const std::size_t begin = s.size();
+	s.grow(count);
+	const std::size_t end = s.size();
+	const std::size_t n = end - begin;
+
+	// Draw each value for every new particle at once
+	rng.fill(s.radius.data() + begin, n, em.minRadius / 100.0f, (em.minRadius + em.maxRadius) / 100.0f);
+	rng.fill(s.speedX.data() + begin, n, -em.maxSpeedX / 20.0f, em.maxSpeedX / 20.0f);
+	rng.fill(s.speedY.data() + begin, n, em.minSpeedY, em.minSpeedY + em.maxSpeedY);
+
+	// Particles without a lifetime never age out
+	if (em.maxLifetime > 0.0f)
+		rng.fill(s.lifetime.data() + begin, n, em.minLifetime, em.maxLifetime);
+	else
+		std::fill(s.lifetime.begin() + begin, s.lifetime.begin() + end, std::numeric_limits< float >::infinity());
+
+	std::fill(s.emitter.begin() + begin, s.emitter.begin() + end, static_cast<std::uint16_t>(e));
+	std::fill(this->reset.begin() + begin, this->reset.begin() + end, 0);
+
+	std::fill(s.posX.begin() + begin, s.posX.begin() + end, em.pos.x);
+	std::fill(s.prevX.begin() + begin, s.prevX.begin() + end, em.pos.x);
+	std::fill(s.posY.begin() + begin, s.posY.begin() + end, em.pos.y);
+	std::fill(s.prevY.begin() + begin, s.prevY.begin() + end, em.pos.y);
+	std::fill(s.velX.begin() + begin, s.velX.begin() + end, 0.0f);
+	std::fill(s.velY.begin() + begin, s.velY.begin() + end, 0.0f);
+	std::fill(s.age.begin() + begin, s.age.begin() + end, 0.0f);
+
+	return *this;
+}
+
+/**
+ * Call fn(begin, end) for each chunk of live particles
+ *   On the thread pool when there is one
+ */
+template <typename Fn>
+void EmitterSystem::forEachChunk(const Fn& fn) {
+	parallel_for(this->pool, this->store.size(), this->chunk, fn);
+}
+
+/**********************************************
+*
+*				Logic
+*
+***********************************************/
+EmitterSystem& EmitterSystem::emit(const float& dt) {
+	TRACE_ZONE("EmitterSystem::emit");
+
+	// In emitter order so the same seed fills the same slots
+	for (std::size_t e = 0; e < this->list.size(); e++)
+	{
+		this->emitted[e] += this->list[e].emissionRate * dt;
+
+		const float whole = std::floor(this->emitted[e]);
+		this->emitted[e] -= whole;
+
+		this->burst(e, static_cast<std::size_t>(whole));
+	}
+
+	return *this;
+}
+EmitterSystem& EmitterSystem::updatePosition(const float& dt) {
+	TRACE_ZONE("EmitterSystem::updatePosition");
+
+	ParticleStore& s = this->store;
+
+	// Gravity * dt of every emitter, looked up per particle below
+	for (std::size_t e = 0; e < this->list.size(); e++)
+		this->gravityStep[e] = this->list[e].gravity * dt;
+
+	const float* g = this->gravityStep.data();
+
+	// One pass over the particles of every emitter
+	this->forEachChunk([&](const std::size_t& begin, const std::size_t& end) {
+		TRACE_ZONE("updatePosition chunk");
+
+		const std::size_t n = end - begin;
+
+		// step() with no gravity then each particle's emitter gravity
+		// Subtracting 0 first leaves speedY exactly as the fused step would
+		if (this->forces)
+			this->forces(s, begin, end, dt);
+		else
+		{
+			this->kernels->step(s.posX.data() + begin, s.posY.data() + begin,
+				s.prevX.data() + begin, s.prevY.data() + begin,
+				s.velX.data() + begin, s.velY.data() + begin,
+				s.speedX.data() + begin, s.speedY.data() + begin,
+				n, dt, 0.0f);
+
+			this->kernels->emitterGravity(s.speedY.data() + begin, s.emitter.data() + begin, g, n);
+		}
+
+		// Mark the particles that left the screen, slowed down or are too old
+		this->kernels->bounce(s.posX.data() + begin, s.posY.data() + begin,
+			s.velX.data() + begin, s.velY.data() + begin,
+			s.radius.data() + begin, this->reset.data() + begin,
+			n, this->edge);
+
+		float* age = s.age.data();
+		const float* lifetime = s.lifetime.data();
+		std::uint8_t* flags = this->reset.data();
+
+		for (std::size_t i = begin; i < end; i++)
+		{
+			age[i] += dt;
+			flags[i] |= age[i] >= lifetime[i];
+		}
+
+		std::copy(s.posX.begin() + begin, s.posX.begin() + end, s.prevX.begin() + begin);
+		std::copy(s.posY.begin() + begin, s.posY.begin() + end, s.prevY.begin() + begin);
+
+		// Pack the survivors while the chunk is in cache
+		this->chunkLive[begin / this->chunk] = s.compact(begin, end, flags);
+	});
+
+	// On one thread, closing the holes moves particles across chunks
+	{
+		TRACE_ZONE("EmitterSystem::closeGaps");
+		s.closeGaps(this->chunkLive.data(), this->chunk);
+	}
+
+	this->emit(dt);
+
+	// Keep particles that are close on screen close in memory
+	this->morton.step(this->store, this->pool, this->chunk);
+
+	return *this;
+}
+EmitterSystem& EmitterSystem::collisions() {
+	if (!this->collide)
+		return *this;
+
+	TRACE_ZONE("EmitterSystem::collisions");
+
+	// Cells as wide as the largest particle of any emitter
+	int largest = 1;
+
+	for (const auto& e : this->list)
+		largest = std::max(largest, e.maxRadius + e.minRadius);
+
+	this->grid.collide(this->store, this->collision, 2.0f * largest / 100.0f, this->pool, this->chunk);
+
+	return *this;
+}
+/**
+ * Write one instance per live particle into out, grouped by material
+ *   See ranges() for where each material starts
+ *   out can point at mapped GPU memory
+ */
+EmitterSystem& EmitterSystem::interpolate(const float& dt, const float& ip, ParticleInstance* out) {
+	return this->interpolate(this->store, dt, ip, out, this->pool);
+}
+/**
+ * Same again from another store of our particles
+ *   Lets a render thread draw a Snapshot while this system is updated on
+ *   another thread. Only interpolate() touches ranges() and its scratch,
+ *   so they belong to whichever thread draws
+ */
+EmitterSystem& EmitterSystem::interpolate(const ParticleStore& from, const float& dt, const float& ip,
+	ParticleInstance* out, ThreadPool* threads) {
+	TRACE_ZONE("EmitterSystem::interpolate");
+
+	const ParticleStore& s = from;
+	const std::size_t m = this->materials();
+	const std::size_t chunks = (s.size() + this->chunk - 1) / this->chunk;
+	const std::uint16_t* materialOf = this->materialOf.data();
+	const float step = dt * ip;
+
+	// Count each material in each chunk
+	this->chunkCounts.assign(chunks * m, 0);
+
+	parallel_for(threads, s.size(), this->chunk, [&](const std::size_t& begin, const std::size_t& end) {
+		std::size_t* counts = this->chunkCounts.data() + begin / this->chunk * m;
+
+		for (std::size_t i = begin; i < end; i++)
+			counts[materialOf[s.emitter[i]]]++;
+	});
+
+	// Turn the counts into where each chunk starts writing each material
+	// Material major so every material ends up in one range
+	this->materialStart.assign(m + 1, 0);
+	std::size_t offset = 0;
+
+	for (std::size_t mat = 0; mat < m; mat++)
+	{
+		this->materialStart[mat] = offset;
+
+		for (std::size_t c = 0; c < chunks; c++)
+		{
+			std::size_t& count = this->chunkCounts[c * m + mat];
+			const std::size_t n = count;
+
+			count = offset;
+			offset += n;
+		}
+	}
+
+	this->materialStart[m] = offset;
+
+	// Scatter the interpolated instances, chunks write disjoint slots
+	parallel_for(threads, s.size(), this->chunk, [&](const std::size_t& begin, const std::size_t& end) {
+		std::size_t* cursor = this->chunkCounts.data() + begin / this->chunk * m;
+
+		for (std::size_t i = begin; i < end; i++)
+		{
+			const std::uint16_t e = s.emitter[i];
+
+			out[cursor[materialOf[e]]++] = ParticleInstance{
+				s.prevX[i] + s.velX[i] * step,
+				s.prevY[i] + s.velY[i] * step,
+				s.radius[i],
+				this->list[e].color
+			};
+		}
+	});
+
+	return *this;
+}
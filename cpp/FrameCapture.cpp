@@ -0,0 +1,392 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "../h/FrameCapture.h"
+#include "../h/Trace.h"
+
+/**
+ * Does pattern take exactly one frame number, like %d or %05d
+ */
+static bool numbered(const std::string& pattern) {
+	const std::size_t at = pattern.find('%');
+
+	if (at == std::string::npos || pattern.find('%', at + 1) != std::string::npos)
+		return false;
+
+	std::size_t i = at + 1;
+
+	while (i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9')
+		i++;
+
+	return i < pattern.size() && pattern[i] == 'd';
+}
+
+FrameCapture::~FrameCapture() {
+	this->finish();
+}
+
+bool FrameCapture::init(const std::string& p, const GLsizei& w, const GLsizei& h, const int& framesPerSecond) {
+	this->finish();
+
+	this->path = p;
+	this->width = w;
+	this->height = h;
+	this->framesRead = 0;
+	this->framesWritten = 0;
+
+	if (p.size() > 4 && p.compare(p.size() - 4, 4, ".y4m") == 0)
+	{
+		this->format = Format::Y4M;
+		this->stream.open(p, std::ios::binary | std::ios::trunc);
+
+		if (!this->stream)
+		{
+			std::cout << "Could not write the capture " << p << "\n";
+			return false;
+		}
+
+		// 4:4:4 so no chroma is lost to subsampling, see writeY4M()
+		this->stream << "YUV4MPEG2 W" << w << " H" << h << " F" << framesPerSecond <<
+			":1 Ip A1:1 C444\n";
+	}
+	else if (numbered(p))
+		this->format = Format::PPM;
+	else
+	{
+		std::cout << "Capture to a .y4m file or a pattern like frames/%05d.ppm, not " << p << "\n";
+		return false;
+	}
+
+	// The framebuffer we draw into instead of the window
+	glGenFramebuffers(1, &this->fbo);
+	glGenRenderbuffers(1, &this->color);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, this->color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->color);
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "FrameCapture FRAMEBUFFER ERROR\n\tStatus " << status << "\n";
+		this->destroy();
+		return false;
+	}
+
+	// Each pixel buffer holds one frame read back from it
+	const GLsizeiptr bytes = static_cast<GLsizeiptr>(w) * h * 4;
+
+	glGenBuffers(ring, this->pbos);
+
+	for (int s = 0; s < ring; s++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pbos[s]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	this->slot = 0;
+	this->running = true;
+	this->worker = std::thread([this] { this->work(); });
+
+	return true;
+}
+bool FrameCapture::isOpen() const {
+	return this->running;
+}
+
+/**********************************************
+*
+*				OpenGL
+*
+***********************************************/
+/**
+ * Draw into the capture instead of the window until the next read()
+ */
+FrameCapture& FrameCapture::bind() {
+	glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+	glViewport(0, 0, this->width, this->height);
+
+	return *this;
+}
+/**
+ * Queue the copy of the frame just drawn into the next pixel buffer
+ *   Hands the frame that buffer held, ring frames ago, to the worker
+ */
+FrameCapture& FrameCapture::read() {
+	TRACE_ZONE("FrameCapture::read");
+
+	if (!this->running)
+		return *this;
+
+	if (this->fences[this->slot] != nullptr)
+		this->collect(this->slot);
+
+	// With a pack buffer bound glReadPixels returns at once and the GPU copies later
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, this->fbo);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pbos[this->slot]);
+	glReadPixels(0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	this->fences[this->slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	this->slot = (this->slot + 1) % ring;
+	this->framesRead++;
+
+	return *this;
+}
+FrameCapture& FrameCapture::finish() {
+	if (!this->running)
+		return *this;
+
+	// Oldest first so the frames stay in order
+	for (int i = 0; i < ring; i++)
+	{
+		const int s = (this->slot + i) % ring;
+
+		if (this->fences[s] != nullptr)
+			this->collect(s);
+	}
+
+	{
+		std::lock_guard< std::mutex > guard(this->lock);
+		this->running = false;
+	}
+
+	this->changed.notify_all();
+	this->worker.join();
+
+	if (this->stream.is_open())
+		this->stream.close();
+
+	std::cout << "Captured " << this->framesWritten << " frames to " << this->path << "\n";
+
+	return this->destroy();
+}
+/**
+ * Copy the frame in pixel buffer s out for the worker
+ *   Its copy was queued ring frames ago so the fence has long signaled
+ */
+FrameCapture& FrameCapture::collect(const int& s) {
+	TRACE_ZONE("FrameCapture::collect");
+
+	GLbitfield flush = GL_SYNC_FLUSH_COMMANDS_BIT;
+
+	while (true)
+	{
+		GLenum status = glClientWaitSync(this->fences[s], flush, 1000000);
+
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED ||
+			status == GL_WAIT_FAILED)
+			break;
+
+		flush = 0;
+	}
+
+	glDeleteSync(this->fences[s]);
+	this->fences[s] = nullptr;
+
+	// Wait for the worker when the disk is that far behind
+	std::vector< std::uint8_t > frame;
+
+	{
+		std::unique_lock< std::mutex > guard(this->lock);
+		this->changed.wait(guard, [this] { return this->frames.size() < queued; });
+
+		if (!this->spare.empty())
+		{
+			frame = std::move(this->spare.back());
+			this->spare.pop_back();
+		}
+	}
+
+	const std::size_t bytes = static_cast<std::size_t>(this->width) * this->height * 4;
+	frame.resize(bytes);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pbos[s]);
+	const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+
+	if (pixels != nullptr)
+		std::memcpy(frame.data(), pixels, bytes);
+
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	{
+		std::lock_guard< std::mutex > guard(this->lock);
+		this->frames.push_back(std::move(frame));
+	}
+
+	this->changed.notify_all();
+
+	return *this;
+}
+FrameCapture& FrameCapture::destroy() {
+	for (int s = 0; s < ring; s++)
+		if (this->fences[s] != nullptr)
+		{
+			glDeleteSync(this->fences[s]);
+			this->fences[s] = nullptr;
+		}
+
+	if (this->pbos[0] != 0)
+		glDeleteBuffers(ring, this->pbos);
+
+	if (this->color != 0)
+		glDeleteRenderbuffers(1, &this->color);
+
+	if (this->fbo != 0)
+		glDeleteFramebuffers(1, &this->fbo);
+
+	for (int s = 0; s < ring; s++)
+		this->pbos[s] = 0;
+
+	this->color = 0;
+	this->fbo = 0;
+
+	return *this;
+}
+
+/**********************************************
+*
+*				Worker
+*
+***********************************************/
+void FrameCapture::work() {
+	TRACE_THREAD("capture");
+
+	std::uint64_t n = 0;
+
+	while (true)
+	{
+		std::vector< std::uint8_t > frame;
+
+		{
+			std::unique_lock< std::mutex > guard(this->lock);
+			this->changed.wait(guard, [this] { return !this->frames.empty() || !this->running; });
+
+			if (this->frames.empty())
+				return;
+
+			frame = std::move(this->frames.front());
+			this->frames.pop_front();
+		}
+
+		// Room in the queue again
+		this->changed.notify_all();
+
+		if (!this->write(frame, n++))
+			std::cout << "Could not write frame " << n - 1 << " of " << this->path << "\n";
+
+		{
+			std::lock_guard< std::mutex > guard(this->lock);
+			this->spare.push_back(std::move(frame));
+			this->framesWritten++;
+		}
+	}
+}
+bool FrameCapture::write(const std::vector< std::uint8_t >& rgba, const std::uint64_t& frame) {
+	TRACE_ZONE("FrameCapture::write");
+
+	if (this->format == Format::Y4M)
+		return this->writeY4M(rgba);
+
+	return this->writePPM(rgba, frame);
+}
+/**
+ * One binary PPM per frame, named by the printf pattern in path
+ *   GL rows start at the bottom, PPM rows at the top
+ */
+bool FrameCapture::writePPM(const std::vector< std::uint8_t >& rgba, const std::uint64_t& frame) {
+	std::vector< char > name(this->path.size() + 32);
+	std::snprintf(name.data(), name.size(), this->path.c_str(), static_cast<int>(frame));
+
+	std::ofstream out(name.data(), std::ios::binary | std::ios::trunc);
+
+	if (!out)
+		return false;
+
+	out << "P6\n" << this->width << " " << this->height << "\n255\n";
+
+	const std::size_t w = this->width;
+	this->scratch.resize(w * 3);
+
+	for (GLsizei y = this->height - 1; y >= 0; y--)
+	{
+		const std::uint8_t* row = rgba.data() + y * w * 4;
+
+		for (std::size_t x = 0; x < w; x++)
+		{
+			this->scratch[x * 3] = row[x * 4];
+			this->scratch[x * 3 + 1] = row[x * 4 + 1];
+			this->scratch[x * 3 + 2] = row[x * 4 + 2];
+		}
+
+		out.write(reinterpret_cast<const char*>(this->scratch.data()), this->scratch.size());
+	}
+
+	return static_cast<bool>(out);
+}
+/**
+ * One FRAME of the stream, the Y, U and V planes top row first
+ *   BT.601 studio range like most players expect
+ */
+bool FrameCapture::writeY4M(const std::vector< std::uint8_t >& rgba) {
+	const std::size_t w = this->width;
+	const std::size_t h = this->height;
+	const std::size_t plane = w * h;
+
+	this->scratch.resize(plane * 3);
+	std::uint8_t* Y = this->scratch.data();
+	std::uint8_t* U = Y + plane;
+	std::uint8_t* V = U + plane;
+
+	for (std::size_t y = 0; y < h; y++)
+	{
+		const std::uint8_t* row = rgba.data() + (h - 1 - y) * w * 4;
+		const std::size_t o = y * w;
+
+		for (std::size_t x = 0; x < w; x++)
+		{
+			const int r = row[x * 4];
+			const int g = row[x * 4 + 1];
+			const int b = row[x * 4 + 2];
+
+			Y[o + x] = static_cast<std::uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+			U[o + x] = static_cast<std::uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+			V[o + x] = static_cast<std::uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		}
+	}
+
+	this->stream << "FRAME\n";
+	this->stream.write(reinterpret_cast<const char*>(this->scratch.data()), this->scratch.size());
+
+	return static_cast<bool>(this->stream);
+}
@@ -0,0 +1,213 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <algorithm>
+
+#include "../h/MortonOrder.h"
+
+MortonOrder& MortonOrder::sort(ParticleStore& s, const std::size_t& begin, const std::size_t& end,
+	ThreadPool* pool, const std::size_t& chunk) {
+	// Nothing to sort
+	if (end < begin + 2)
+		return *this;
+
+	TRACE_ZONE("MortonOrder::sort");
+
+	const std::size_t n = end - begin;
+
+	const float* x = s.posX.data() + begin;
+	const float* y = s.posY.data() + begin;
+
+	// The bounding box of the range, each chunk then all of them
+	const std::size_t chunks = (n + chunk - 1) / chunk;
+	this->chunkBounds.resize(chunks * 4);
+
+	parallel_for(pool, n, chunk, [&](const std::size_t& first, const std::size_t& last) {
+		float lo[2] = { x[first], y[first] };
+		float hi[2] = { x[first], y[first] };
+
+		for (std::size_t i = first; i < last; i++)
+		{
+			lo[0] = std::min(lo[0], x[i]);
+			lo[1] = std::min(lo[1], y[i]);
+			hi[0] = std::max(hi[0], x[i]);
+			hi[1] = std::max(hi[1], y[i]);
+		}
+
+		float* bounds = this->chunkBounds.data() + first / chunk * 4;
+		bounds[0] = lo[0];
+		bounds[1] = lo[1];
+		bounds[2] = hi[0];
+		bounds[3] = hi[1];
+	});
+
+	float lo[2] = { this->chunkBounds[0], this->chunkBounds[1] };
+	float hi[2] = { this->chunkBounds[2], this->chunkBounds[3] };
+
+	for (std::size_t c = 1; c < chunks; c++)
+	{
+		lo[0] = std::min(lo[0], this->chunkBounds[c * 4]);
+		lo[1] = std::min(lo[1], this->chunkBounds[c * 4 + 1]);
+		hi[0] = std::max(hi[0], this->chunkBounds[c * 4 + 2]);
+		hi[1] = std::max(hi[1], this->chunkBounds[c * 4 + 3]);
+	}
+
+	// Square cells so the curve does not stretch along the longer side
+	const float top = static_cast<float>((1u << bits) - 1);
+	const float side = std::max(hi[0] - lo[0], hi[1] - lo[1]);
+	const float scale = side > 0.0f ? top / side : 0.0f;
+
+	this->keys.resize(n);
+	this->keysOut.resize(n);
+	this->order.resize(n);
+	this->orderOut.resize(n);
+
+	// Plain pointers, the compiler can not tell the vectors' own pointers
+	// are not written through the uint32_t stores and reloads them
+	std::uint32_t* keys = this->keys.data();
+	std::uint32_t* order = this->order.data();
+
+	parallel_for(pool, n, chunk, [&](const std::size_t& first, const std::size_t& last) {
+		for (std::size_t i = first; i < last; i++)
+		{
+			// Written so a NaN lands in cell 0 instead of casting out of range
+			const float qx = std::min((x[i] - lo[0]) * scale, top);
+			const float qy = std::min((y[i] - lo[1]) * scale, top);
+
+			keys[i] = code(qx > 0.0f ? static_cast<std::uint32_t>(qx) : 0,
+				qy > 0.0f ? static_cast<std::uint32_t>(qy) : 0);
+			order[i] = static_cast<std::uint32_t>(i);
+		}
+	});
+
+	for (unsigned shift = 0; shift < 2 * bits; shift += digitBits)
+		this->radixPass(n, shift, pool, chunk);
+
+	// Gather every array through the order, one array at a time
+	// so only one array of scratch is needed
+	{
+		TRACE_ZONE("MortonOrder::gather");
+
+		const std::uint32_t* from = this->order.data();
+		this->gathered.resize(n);
+		this->gatheredEmitter.resize(n);
+
+		float* gathered = this->gathered.data();
+		std::uint16_t* gatheredEmitter = this->gatheredEmitter.data();
+
+		for (auto array : s.arrays())
+		{
+			const float* in = array->data() + begin;
+
+			parallel_for(pool, n, chunk, [&](const std::size_t& first, const std::size_t& last) {
+				for (std::size_t k = first; k < last; k++)
+					gathered[k] = in[from[k]];
+			});
+
+			std::copy(gathered, gathered + n, array->data() + begin);
+		}
+
+		const std::uint16_t* emitter = s.emitter.data() + begin;
+
+		parallel_for(pool, n, chunk, [&](const std::size_t& first, const std::size_t& last) {
+			for (std::size_t k = first; k < last; k++)
+				gatheredEmitter[k] = emitter[from[k]];
+		});
+
+		std::copy(gatheredEmitter, gatheredEmitter + n, s.emitter.data() + begin);
+	}
+
+	return *this;
+}
+/**
+ * Sort keys and order by the digit of each key at shift
+ *   Leaves the sorted pairs back in keys and order
+ */
+MortonOrder& MortonOrder::radixPass(const std::size_t& n, const unsigned& shift,
+	ThreadPool* pool, const std::size_t& chunk) {
+	TRACE_ZONE("MortonOrder::radixPass");
+
+	const std::size_t chunks = (n + chunk - 1) / chunk;
+	const std::uint32_t mask = static_cast<std::uint32_t>(digits - 1);
+
+	this->chunkCounts.assign(chunks * digits, 0);
+
+	const std::uint32_t* keys = this->keys.data();
+	const std::uint32_t* order = this->order.data();
+	std::uint32_t* keysOut = this->keysOut.data();
+	std::uint32_t* orderOut = this->orderOut.data();
+	std::uint32_t* chunkCounts = this->chunkCounts.data();
+
+	// Count the digits of each chunk
+	parallel_for(pool, n, chunk, [&](const std::size_t& first, const std::size_t& last) {
+		std::uint32_t* counts = chunkCounts + first / chunk * digits;
+
+		for (std::size_t i = first; i < last; i++)
+			counts[(keys[i] >> shift) & mask]++;
+	});
+
+	// Where each chunk writes each digit, every chunk's 0s, then every chunk's 1s...
+	std::uint32_t offset = 0;
+
+	for (std::size_t d = 0; d < digits; d++)
+		for (std::size_t c = 0; c < chunks; c++)
+		{
+			std::uint32_t& count = chunkCounts[c * digits + d];
+			const std::uint32_t seen = count;
+
+			count = offset;
+			offset += seen;
+		}
+
+	// Scatter each chunk in order so equal digits keep their order
+	parallel_for(pool, n, chunk, [&](const std::size_t& first, const std::size_t& last) {
+		std::uint32_t* cursor = chunkCounts + first / chunk * digits;
+
+		for (std::size_t i = first; i < last; i++)
+		{
+			const std::uint32_t to = cursor[(keys[i] >> shift) & mask]++;
+
+			keysOut[to] = keys[i];
+			orderOut[to] = order[i];
+		}
+	});
+
+	this->keys.swap(this->keysOut);
+	this->order.swap(this->orderOut);
+
+	return *this;
+}
+MortonOrder& MortonOrder::step(ParticleStore& s, ThreadPool* pool, const std::size_t& chunk) {
+	if (this->slices == 0 || s.size() == 0)
+		return *this;
+
+	const std::size_t slice = this->next;
+	this->next = (this->next + 1) % this->slices;
+
+	const std::size_t chunks = (s.size() + chunk - 1) / chunk;
+	const std::size_t begin = std::min(chunks * slice / this->slices * chunk, s.size());
+	const std::size_t end = std::min(chunks * (slice + 1) / this->slices * chunk, s.size());
+
+	return this->sort(s, begin, end, pool, chunk);
+}
+MortonOrder& MortonOrder::rewind() {
+	this->next = 0;
+
+	return *this;
+}
@@ -43,13 +43,12 @@ Particle& Particle::init() {
 *
 ***********************************************/
 Particle& Particle::compileShaders() {
-	GLProgram temp{
-	    {
-	        GLShader{GL_VERTEX_SHADER, "glsl/vertex.glsl"},
-	        GLShader{GL_FRAGMENT_SHADER, "glsl/fragment.glsl"}
-	    }
-	};
-	this->program["simple"] = temp;
+	// Compiled once and shared by every particle
+	// See GLProgramCache
+	this->program["simple"] = GLProgramCache::shared().get({
+	    {GL_VERTEX_SHADER, "glsl/vertex.glsl"},
+	    {GL_FRAGMENT_SHADER, "glsl/fragment.glsl"}
+	});
 	return *this;
 }
 Particle& Particle::fillBuffers() {
@@ -221,7 +220,8 @@ Particle& Particle::draw() {
 	this->updateGL();
 
 	// Draw our triangles in a fan to create our circle
-	glDrawArrays(GL_TRIANGLE_FAN, 0, this->numVertices * 3);
+	// numVertices counts floats, three per vertex
+	glDrawArrays(GL_TRIANGLE_FAN, 0, this->numVertices / 3);
 
 
 	// Unbind the VAO and stop using the program so other objects
@@ -0,0 +1,189 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <cmath>
+#include <cstdlib>
+
+#include "../h/ParticleKernels.h"
+
+#ifdef PARTICLES_X86_KERNELS
+extern const ParticleKernels sse2_kernels;
+extern const ParticleKernels avx2_kernels;
+extern const ParticleKernels avx512_kernels;
+#endif
+
+/**********************************************
+*
+*				Scalar
+*
+***********************************************/
+static void scalar_movement(float* velX, float* velY,
+	const float* speedX, const float* speedY,
+	std::size_t n, float dt) {
+	for (std::size_t i = 0; i < n; i++)
+	{
+		velX[i] += speedX[i] * dt;
+		velY[i] += speedY[i] * dt;
+	}
+}
+static void scalar_gravity(float* speedY, std::size_t n, float g) {
+	for (std::size_t i = 0; i < n; i++)
+		speedY[i] -= g;
+}
+static void scalar_integrate(float* posX, float* posY,
+	const float* prevX, const float* prevY,
+	const float* velX, const float* velY,
+	std::size_t n, float step) {
+	for (std::size_t i = 0; i < n; i++)
+	{
+		posX[i] = prevX[i] + velX[i] * step;
+		posY[i] = prevY[i] + velY[i] * step;
+	}
+}
+static void scalar_step(float* posX, float* posY,
+	const float* prevX, const float* prevY,
+	float* velX, float* velY,
+	const float* speedX, float* speedY,
+	std::size_t n, float dt, float g) {
+	for (std::size_t i = 0; i < n; i++)
+	{
+		float vx = velX[i] + speedX[i] * dt;
+		float vy = velY[i] + speedY[i] * dt;
+
+		velX[i] = vx;
+		velY[i] = vy;
+		speedY[i] -= g;
+
+		posX[i] = prevX[i] + vx * dt;
+		posY[i] = prevY[i] + vy * dt;
+	}
+}
+static void scalar_bounce(const float* posX, float* posY,
+	float* velX, float* velY,
+	const float* radius, std::uint8_t* reset,
+	std::size_t n, const EdgeParams& edge) {
+	for (std::size_t i = 0; i < n; i++)
+	{
+		bool slow = false;
+
+		// If the edge of the particle is below the screen bottom
+		if (posY[i] - radius[i] <= edge.floor)
+		{
+			// Rest on the screen bottom and bounce with damping
+			posY[i] = radius[i];
+			velY[i] *= edge.bounce;
+			velX[i] *= edge.friction;
+
+			// Only upward bounces slower than the limit count as slow vertically
+			slow = std::abs(velX[i]) < edge.slow && velY[i] < edge.slow;
+		}
+
+		// Past the left or right screen edge
+		bool out = posX[i] - radius[i] > edge.right || posX[i] + radius[i] < edge.left;
+
+		reset[i] = slow || out;
+	}
+}
+
+static void scalar_emitterGravity(float* speedY, const std::uint16_t* emitter,
+	const float* g, std::size_t n) {
+	for (std::size_t i = 0; i < n; i++)
+		speedY[i] -= g[emitter[i]];
+}
+static void scalar_instances(ParticleInstance* out,
+	const float* prevX, const float* prevY,
+	const float* velX, const float* velY,
+	const float* radius, std::size_t n,
+	float step, std::uint32_t color) {
+	for (std::size_t i = 0; i < n; i++)
+		out[i] = ParticleInstance{
+			prevX[i] + velX[i] * step,
+			prevY[i] + velY[i] * step,
+			radius[i],
+			color
+		};
+}
+
+static const ParticleKernels scalar_kernels = {
+	"scalar",
+	scalar_movement,
+	scalar_gravity,
+	scalar_integrate,
+	scalar_step,
+	scalar_bounce,
+	scalar_emitterGravity,
+	scalar_instances
+};
+
+/**********************************************
+*
+*				Dispatch
+*
+***********************************************/
+const ParticleKernels& ParticleKernels::scalar() {
+	return scalar_kernels;
+}
+const ParticleKernels* ParticleKernels::sse2() {
+#ifdef PARTICLES_X86_KERNELS
+	if (__builtin_cpu_supports("sse2"))
+		return &sse2_kernels;
+#endif
+	return nullptr;
+}
+const ParticleKernels* ParticleKernels::avx2() {
+#ifdef PARTICLES_X86_KERNELS
+	if (__builtin_cpu_supports("avx2"))
+		return &avx2_kernels;
+#endif
+	return nullptr;
+}
+const ParticleKernels* ParticleKernels::avx512() {
+#ifdef PARTICLES_X86_KERNELS
+	if (__builtin_cpu_supports("avx512f"))
+		return &avx512_kernels;
+#endif
+	return nullptr;
+}
+const ParticleKernels& ParticleKernels::get(const String& name) {
+	const ParticleKernels* k = nullptr;
+
+	if (name == "avx512")
+		k = avx512();
+	else if (name == "avx2")
+		k = avx2();
+	else if (name == "sse2")
+		k = sse2();
+
+	return k ? *k : scalar();
+}
+const ParticleKernels& ParticleKernels::get() {
+	// Pick once, the CPU is not going to change under us
+	static const ParticleKernels& best = []() -> const ParticleKernels& {
+		if (const char* env = std::getenv("PARTICLES_KERNELS"))
+			return get(env);
+
+		for (auto k : { avx512(), avx2(), sse2() })
+			if (k)
+				return *k;
+
+		return scalar();
+	}();
+
+	return best;
+}
@@ -0,0 +1,172 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <immintrin.h>
+#include <cstring>
+
+#include "../h/ParticleKernels.h"
+
+// Writing instances is bound by the stores, the SSE2 version is as fast as it gets
+void sse2_instances(ParticleInstance* out,
+	const float* prevX, const float* prevY,
+	const float* velX, const float* velY,
+	const float* radius, std::size_t n,
+	float step, std::uint32_t color);
+
+// 8 particles per iteration, the remainder goes through the scalar kernels
+// Multiplies and adds are kept separate (no FMA) to round like the scalar kernels
+
+static void avx2_movement(float* velX, float* velY,
+	const float* speedX, const float* speedY,
+	std::size_t n, float dt) {
+	const __m256 vdt = _mm256_set1_ps(dt);
+	std::size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm256_storeu_ps(velX + i, _mm256_add_ps(_mm256_loadu_ps(velX + i), _mm256_mul_ps(_mm256_loadu_ps(speedX + i), vdt)));
+		_mm256_storeu_ps(velY + i, _mm256_add_ps(_mm256_loadu_ps(velY + i), _mm256_mul_ps(_mm256_loadu_ps(speedY + i), vdt)));
+	}
+
+	ParticleKernels::scalar().movement(velX + i, velY + i, speedX + i, speedY + i, n - i, dt);
+}
+static void avx2_gravity(float* speedY, std::size_t n, float g) {
+	const __m256 vg = _mm256_set1_ps(g);
+	std::size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(speedY + i, _mm256_sub_ps(_mm256_loadu_ps(speedY + i), vg));
+
+	ParticleKernels::scalar().gravity(speedY + i, n - i, g);
+}
+static void avx2_integrate(float* posX, float* posY,
+	const float* prevX, const float* prevY,
+	const float* velX, const float* velY,
+	std::size_t n, float step) {
+	const __m256 vstep = _mm256_set1_ps(step);
+	std::size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm256_storeu_ps(posX + i, _mm256_add_ps(_mm256_loadu_ps(prevX + i), _mm256_mul_ps(_mm256_loadu_ps(velX + i), vstep)));
+		_mm256_storeu_ps(posY + i, _mm256_add_ps(_mm256_loadu_ps(prevY + i), _mm256_mul_ps(_mm256_loadu_ps(velY + i), vstep)));
+	}
+
+	ParticleKernels::scalar().integrate(posX + i, posY + i, prevX + i, prevY + i, velX + i, velY + i, n - i, step);
+}
+static void avx2_step(float* posX, float* posY,
+	const float* prevX, const float* prevY,
+	float* velX, float* velY,
+	const float* speedX, float* speedY,
+	std::size_t n, float dt, float g) {
+	const __m256 vdt = _mm256_set1_ps(dt);
+	const __m256 vg = _mm256_set1_ps(g);
+	std::size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 sy = _mm256_loadu_ps(speedY + i);
+		__m256 vx = _mm256_add_ps(_mm256_loadu_ps(velX + i), _mm256_mul_ps(_mm256_loadu_ps(speedX + i), vdt));
+		__m256 vy = _mm256_add_ps(_mm256_loadu_ps(velY + i), _mm256_mul_ps(sy, vdt));
+
+		_mm256_storeu_ps(velX + i, vx);
+		_mm256_storeu_ps(velY + i, vy);
+		_mm256_storeu_ps(speedY + i, _mm256_sub_ps(sy, vg));
+
+		_mm256_storeu_ps(posX + i, _mm256_add_ps(_mm256_loadu_ps(prevX + i), _mm256_mul_ps(vx, vdt)));
+		_mm256_storeu_ps(posY + i, _mm256_add_ps(_mm256_loadu_ps(prevY + i), _mm256_mul_ps(vy, vdt)));
+	}
+
+	ParticleKernels::scalar().step(posX + i, posY + i, prevX + i, prevY + i,
+		velX + i, velY + i, speedX + i, speedY + i, n - i, dt, g);
+}
+static void avx2_bounce(const float* posX, float* posY,
+	float* velX, float* velY,
+	const float* radius, std::uint8_t* reset,
+	std::size_t n, const EdgeParams& edge) {
+	const __m256 floor = _mm256_set1_ps(edge.floor);
+	const __m256 left = _mm256_set1_ps(edge.left);
+	const __m256 right = _mm256_set1_ps(edge.right);
+	const __m256 bounce = _mm256_set1_ps(edge.bounce);
+	const __m256 friction = _mm256_set1_ps(edge.friction);
+	const __m256 slow = _mm256_set1_ps(edge.slow);
+	const __m256 abs = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m128i one = _mm_set1_epi8(1);
+	std::size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 px = _mm256_loadu_ps(posX + i);
+		__m256 py = _mm256_loadu_ps(posY + i);
+		__m256 vx = _mm256_loadu_ps(velX + i);
+		__m256 vy = _mm256_loadu_ps(velY + i);
+		__m256 r = _mm256_loadu_ps(radius + i);
+
+		__m256 hit = _mm256_cmp_ps(_mm256_sub_ps(py, r), floor, _CMP_LE_OQ);
+
+		py = _mm256_blendv_ps(py, r, hit);
+		vy = _mm256_blendv_ps(vy, _mm256_mul_ps(vy, bounce), hit);
+		vx = _mm256_blendv_ps(vx, _mm256_mul_ps(vx, friction), hit);
+
+		__m256 isSlow = _mm256_and_ps(hit, _mm256_and_ps(
+			_mm256_cmp_ps(_mm256_and_ps(vx, abs), slow, _CMP_LT_OQ),
+			_mm256_cmp_ps(vy, slow, _CMP_LT_OQ)));
+		__m256 out = _mm256_or_ps(
+			_mm256_cmp_ps(_mm256_sub_ps(px, r), right, _CMP_GT_OQ),
+			_mm256_cmp_ps(_mm256_add_ps(px, r), left, _CMP_LT_OQ));
+
+		_mm256_storeu_ps(posY + i, py);
+		_mm256_storeu_ps(velX + i, vx);
+		_mm256_storeu_ps(velY + i, vy);
+
+		// Narrow the 8 lane masks to 8 bytes of 0 or 1
+		__m256i m = _mm256_castps_si256(_mm256_or_ps(isSlow, out));
+		__m128i m16 = _mm_packs_epi32(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1));
+		__m128i m8 = _mm_and_si128(_mm_packs_epi16(m16, m16), one);
+
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(reset + i), m8);
+	}
+
+	ParticleKernels::scalar().bounce(posX + i, posY + i, velX + i, velY + i,
+		radius + i, reset + i, n - i, edge);
+}
+
+static void avx2_emitterGravity(float* speedY, const std::uint16_t* emitter,
+	const float* g, std::size_t n) {
+	std::size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i e = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(emitter + i)));
+		_mm256_storeu_ps(speedY + i, _mm256_sub_ps(_mm256_loadu_ps(speedY + i), _mm256_i32gather_ps(g, e, 4)));
+	}
+
+	ParticleKernels::scalar().emitterGravity(speedY + i, emitter + i, g, n - i);
+}
+
+extern const ParticleKernels avx2_kernels = {
+	"avx2",
+	avx2_movement,
+	avx2_gravity,
+	avx2_integrate,
+	avx2_step,
+	avx2_bounce,
+	avx2_emitterGravity,
+	sse2_instances
+};
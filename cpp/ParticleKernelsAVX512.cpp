@@ -0,0 +1,172 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <immintrin.h>
+
+#include "../h/ParticleKernels.h"
+
+// Writing instances is bound by the stores, the SSE2 version is as fast as it gets
+void sse2_instances(ParticleInstance* out,
+	const float* prevX, const float* prevY,
+	const float* velX, const float* velY,
+	const float* radius, std::size_t n,
+	float step, std::uint32_t color);
+
+// 16 particles per iteration, the remainder goes through the scalar kernels
+// Multiplies and adds are kept separate (no FMA) to round like the scalar kernels
+
+static void avx512_movement(float* velX, float* velY,
+	const float* speedX, const float* speedY,
+	std::size_t n, float dt) {
+	const __m512 vdt = _mm512_set1_ps(dt);
+	std::size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		_mm512_storeu_ps(velX + i, _mm512_add_ps(_mm512_loadu_ps(velX + i), _mm512_mul_ps(_mm512_loadu_ps(speedX + i), vdt)));
+		_mm512_storeu_ps(velY + i, _mm512_add_ps(_mm512_loadu_ps(velY + i), _mm512_mul_ps(_mm512_loadu_ps(speedY + i), vdt)));
+	}
+
+	ParticleKernels::scalar().movement(velX + i, velY + i, speedX + i, speedY + i, n - i, dt);
+}
+static void avx512_gravity(float* speedY, std::size_t n, float g) {
+	const __m512 vg = _mm512_set1_ps(g);
+	std::size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+		_mm512_storeu_ps(speedY + i, _mm512_sub_ps(_mm512_loadu_ps(speedY + i), vg));
+
+	ParticleKernels::scalar().gravity(speedY + i, n - i, g);
+}
+static void avx512_integrate(float* posX, float* posY,
+	const float* prevX, const float* prevY,
+	const float* velX, const float* velY,
+	std::size_t n, float step) {
+	const __m512 vstep = _mm512_set1_ps(step);
+	std::size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		_mm512_storeu_ps(posX + i, _mm512_add_ps(_mm512_loadu_ps(prevX + i), _mm512_mul_ps(_mm512_loadu_ps(velX + i), vstep)));
+		_mm512_storeu_ps(posY + i, _mm512_add_ps(_mm512_loadu_ps(prevY + i), _mm512_mul_ps(_mm512_loadu_ps(velY + i), vstep)));
+	}
+
+	ParticleKernels::scalar().integrate(posX + i, posY + i, prevX + i, prevY + i, velX + i, velY + i, n - i, step);
+}
+static void avx512_step(float* posX, float* posY,
+	const float* prevX, const float* prevY,
+	float* velX, float* velY,
+	const float* speedX, float* speedY,
+	std::size_t n, float dt, float g) {
+	const __m512 vdt = _mm512_set1_ps(dt);
+	const __m512 vg = _mm512_set1_ps(g);
+	std::size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512 sy = _mm512_loadu_ps(speedY + i);
+		__m512 vx = _mm512_add_ps(_mm512_loadu_ps(velX + i), _mm512_mul_ps(_mm512_loadu_ps(speedX + i), vdt));
+		__m512 vy = _mm512_add_ps(_mm512_loadu_ps(velY + i), _mm512_mul_ps(sy, vdt));
+
+		_mm512_storeu_ps(velX + i, vx);
+		_mm512_storeu_ps(velY + i, vy);
+		_mm512_storeu_ps(speedY + i, _mm512_sub_ps(sy, vg));
+
+		_mm512_storeu_ps(posX + i, _mm512_add_ps(_mm512_loadu_ps(prevX + i), _mm512_mul_ps(vx, vdt)));
+		_mm512_storeu_ps(posY + i, _mm512_add_ps(_mm512_loadu_ps(prevY + i), _mm512_mul_ps(vy, vdt)));
+	}
+
+	ParticleKernels::scalar().step(posX + i, posY + i, prevX + i, prevY + i,
+		velX + i, velY + i, speedX + i, speedY + i, n - i, dt, g);
+}
+static void avx512_bounce(const float* posX, float* posY,
+	float* velX, float* velY,
+	const float* radius, std::uint8_t* reset,
+	std::size_t n, const EdgeParams& edge) {
+	const __m512 floor = _mm512_set1_ps(edge.floor);
+	const __m512 left = _mm512_set1_ps(edge.left);
+	const __m512 right = _mm512_set1_ps(edge.right);
+	const __m512 bounce = _mm512_set1_ps(edge.bounce);
+	const __m512 friction = _mm512_set1_ps(edge.friction);
+	const __m512 slow = _mm512_set1_ps(edge.slow);
+	const __m512i one = _mm512_set1_epi32(1);
+	const __m512i abs = _mm512_set1_epi32(0x7fffffff);
+	std::size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512 px = _mm512_loadu_ps(posX + i);
+		__m512 py = _mm512_loadu_ps(posY + i);
+		__m512 vx = _mm512_loadu_ps(velX + i);
+		__m512 vy = _mm512_loadu_ps(velY + i);
+		__m512 r = _mm512_loadu_ps(radius + i);
+
+		__mmask16 hit = _mm512_cmp_ps_mask(_mm512_sub_ps(py, r), floor, _CMP_LE_OQ);
+
+		py = _mm512_mask_mov_ps(py, hit, r);
+		vy = _mm512_mask_mul_ps(vy, hit, vy, bounce);
+		vx = _mm512_mask_mul_ps(vx, hit, vx, friction);
+
+		__mmask16 isSlow = hit &
+			_mm512_cmp_ps_mask(_mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(vx), abs)), slow, _CMP_LT_OQ) &
+			_mm512_cmp_ps_mask(vy, slow, _CMP_LT_OQ);
+		__mmask16 out =
+			_mm512_cmp_ps_mask(_mm512_sub_ps(px, r), right, _CMP_GT_OQ) |
+			_mm512_cmp_ps_mask(_mm512_add_ps(px, r), left, _CMP_LT_OQ);
+
+		_mm512_storeu_ps(posY + i, py);
+		_mm512_storeu_ps(velX + i, vx);
+		_mm512_storeu_ps(velY + i, vy);
+
+		// Widen the 16 bit mask to 16 bytes of 0 or 1
+		_mm512_mask_cvtepi32_storeu_epi8(reset + i, 0xFFFF,
+			_mm512_maskz_mov_epi32(isSlow | out, one));
+	}
+
+	ParticleKernels::scalar().bounce(posX + i, posY + i, velX + i, velY + i,
+		radius + i, reset + i, n - i, edge);
+}
+
+static void avx512_emitterGravity(float* speedY, const std::uint16_t* emitter,
+	const float* g, std::size_t n) {
+	const __m512 zero = _mm512_setzero_ps();
+	std::size_t i = 0;
+
+	// The masked forms with every lane set keep GCC from warning about
+	// the uninitialized source its headers pass to the unmasked ones
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512i e = _mm512_maskz_cvtepu16_epi32(0xFFFF, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(emitter + i)));
+		__m512 gi = _mm512_mask_i32gather_ps(zero, 0xFFFF, e, g, 4);
+		_mm512_storeu_ps(speedY + i, _mm512_sub_ps(_mm512_loadu_ps(speedY + i), gi));
+	}
+
+	ParticleKernels::scalar().emitterGravity(speedY + i, emitter + i, g, n - i);
+}
+
+extern const ParticleKernels avx512_kernels = {
+	"avx512",
+	avx512_movement,
+	avx512_gravity,
+	avx512_integrate,
+	avx512_step,
+	avx512_bounce,
+	avx512_emitterGravity,
+	sse2_instances
+};
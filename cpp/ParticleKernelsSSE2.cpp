@@ -0,0 +1,192 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <emmintrin.h>
+#include <cstring>
+
+#include "../h/ParticleKernels.h"
+
+// 4 particles per iteration, the remainder goes through the scalar kernels
+
+static void sse2_movement(float* velX, float* velY,
+	const float* speedX, const float* speedY,
+	std::size_t n, float dt) {
+	const __m128 vdt = _mm_set1_ps(dt);
+	std::size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		_mm_storeu_ps(velX + i, _mm_add_ps(_mm_loadu_ps(velX + i), _mm_mul_ps(_mm_loadu_ps(speedX + i), vdt)));
+		_mm_storeu_ps(velY + i, _mm_add_ps(_mm_loadu_ps(velY + i), _mm_mul_ps(_mm_loadu_ps(speedY + i), vdt)));
+	}
+
+	ParticleKernels::scalar().movement(velX + i, velY + i, speedX + i, speedY + i, n - i, dt);
+}
+static void sse2_gravity(float* speedY, std::size_t n, float g) {
+	const __m128 vg = _mm_set1_ps(g);
+	std::size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(speedY + i, _mm_sub_ps(_mm_loadu_ps(speedY + i), vg));
+
+	ParticleKernels::scalar().gravity(speedY + i, n - i, g);
+}
+static void sse2_integrate(float* posX, float* posY,
+	const float* prevX, const float* prevY,
+	const float* velX, const float* velY,
+	std::size_t n, float step) {
+	const __m128 vstep = _mm_set1_ps(step);
+	std::size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		_mm_storeu_ps(posX + i, _mm_add_ps(_mm_loadu_ps(prevX + i), _mm_mul_ps(_mm_loadu_ps(velX + i), vstep)));
+		_mm_storeu_ps(posY + i, _mm_add_ps(_mm_loadu_ps(prevY + i), _mm_mul_ps(_mm_loadu_ps(velY + i), vstep)));
+	}
+
+	ParticleKernels::scalar().integrate(posX + i, posY + i, prevX + i, prevY + i, velX + i, velY + i, n - i, step);
+}
+static void sse2_step(float* posX, float* posY,
+	const float* prevX, const float* prevY,
+	float* velX, float* velY,
+	const float* speedX, float* speedY,
+	std::size_t n, float dt, float g) {
+	const __m128 vdt = _mm_set1_ps(dt);
+	const __m128 vg = _mm_set1_ps(g);
+	std::size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 sy = _mm_loadu_ps(speedY + i);
+		__m128 vx = _mm_add_ps(_mm_loadu_ps(velX + i), _mm_mul_ps(_mm_loadu_ps(speedX + i), vdt));
+		__m128 vy = _mm_add_ps(_mm_loadu_ps(velY + i), _mm_mul_ps(sy, vdt));
+
+		_mm_storeu_ps(velX + i, vx);
+		_mm_storeu_ps(velY + i, vy);
+		_mm_storeu_ps(speedY + i, _mm_sub_ps(sy, vg));
+
+		_mm_storeu_ps(posX + i, _mm_add_ps(_mm_loadu_ps(prevX + i), _mm_mul_ps(vx, vdt)));
+		_mm_storeu_ps(posY + i, _mm_add_ps(_mm_loadu_ps(prevY + i), _mm_mul_ps(vy, vdt)));
+	}
+
+	ParticleKernels::scalar().step(posX + i, posY + i, prevX + i, prevY + i,
+		velX + i, velY + i, speedX + i, speedY + i, n - i, dt, g);
+}
+static inline __m128 select(const __m128& mask, const __m128& a, const __m128& b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+static void sse2_bounce(const float* posX, float* posY,
+	float* velX, float* velY,
+	const float* radius, std::uint8_t* reset,
+	std::size_t n, const EdgeParams& edge) {
+	const __m128 floor = _mm_set1_ps(edge.floor);
+	const __m128 left = _mm_set1_ps(edge.left);
+	const __m128 right = _mm_set1_ps(edge.right);
+	const __m128 bounce = _mm_set1_ps(edge.bounce);
+	const __m128 friction = _mm_set1_ps(edge.friction);
+	const __m128 slow = _mm_set1_ps(edge.slow);
+	const __m128 abs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128i one = _mm_set1_epi8(1);
+	std::size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 px = _mm_loadu_ps(posX + i);
+		__m128 py = _mm_loadu_ps(posY + i);
+		__m128 vx = _mm_loadu_ps(velX + i);
+		__m128 vy = _mm_loadu_ps(velY + i);
+		__m128 r = _mm_loadu_ps(radius + i);
+
+		__m128 hit = _mm_cmple_ps(_mm_sub_ps(py, r), floor);
+
+		py = select(hit, r, py);
+		vy = select(hit, _mm_mul_ps(vy, bounce), vy);
+		vx = select(hit, _mm_mul_ps(vx, friction), vx);
+
+		__m128 isSlow = _mm_and_ps(hit, _mm_and_ps(
+			_mm_cmplt_ps(_mm_and_ps(vx, abs), slow),
+			_mm_cmplt_ps(vy, slow)));
+		__m128 out = _mm_or_ps(
+			_mm_cmpgt_ps(_mm_sub_ps(px, r), right),
+			_mm_cmplt_ps(_mm_add_ps(px, r), left));
+
+		_mm_storeu_ps(posY + i, py);
+		_mm_storeu_ps(velX + i, vx);
+		_mm_storeu_ps(velY + i, vy);
+
+		// Narrow the 4 lane masks to 4 bytes of 0 or 1
+		__m128i m = _mm_castps_si128(_mm_or_ps(isSlow, out));
+		m = _mm_packs_epi32(m, m);
+		m = _mm_and_si128(_mm_packs_epi16(m, m), one);
+
+		int bytes = _mm_cvtsi128_si32(m);
+		std::memcpy(reset + i, &bytes, 4);
+	}
+
+	ParticleKernels::scalar().bounce(posX + i, posY + i, velX + i, velY + i,
+		radius + i, reset + i, n - i, edge);
+}
+
+// Not static, the AVX2 and AVX-512 kernels use it too
+void sse2_instances(ParticleInstance* out,
+	const float* prevX, const float* prevY,
+	const float* velX, const float* velY,
+	const float* radius, std::size_t n,
+	float step, std::uint32_t color) {
+	const __m128 vstep = _mm_set1_ps(step);
+	const __m128 vcolor = _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(color)));
+	std::size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x = _mm_add_ps(_mm_loadu_ps(prevX + i), _mm_mul_ps(_mm_loadu_ps(velX + i), vstep));
+		__m128 y = _mm_add_ps(_mm_loadu_ps(prevY + i), _mm_mul_ps(_mm_loadu_ps(velY + i), vstep));
+		__m128 r = _mm_loadu_ps(radius + i);
+		__m128 c = vcolor;
+
+		// Four columns of x, y, radius and color become four instances
+		_MM_TRANSPOSE4_PS(x, y, r, c);
+
+		float* dst = reinterpret_cast<float*>(out + i);
+		_mm_storeu_ps(dst, x);
+		_mm_storeu_ps(dst + 4, y);
+		_mm_storeu_ps(dst + 8, r);
+		_mm_storeu_ps(dst + 12, c);
+	}
+
+	ParticleKernels::scalar().instances(out + i, prevX + i, prevY + i,
+		velX + i, velY + i, radius + i, n - i, step, color);
+}
+
+// SSE2 has no gather, the table lookups dominate anyway
+static void sse2_emitterGravity(float* speedY, const std::uint16_t* emitter,
+	const float* g, std::size_t n) {
+	ParticleKernels::scalar().emitterGravity(speedY, emitter, g, n);
+}
+
+extern const ParticleKernels sse2_kernels = {
+	"sse2",
+	sse2_movement,
+	sse2_gravity,
+	sse2_integrate,
+	sse2_step,
+	sse2_bounce,
+	sse2_emitterGravity,
+	sse2_instances
+};
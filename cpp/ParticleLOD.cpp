@@ -0,0 +1,89 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <cmath>
+#include <limits>
+#include <string>
+#include <unordered_map>
+
+#include "../h/ParticleLOD.h"
+
+/**********************************************
+*
+*				OpenGL
+*
+***********************************************/
+ParticleLOD& ParticleLOD::fillBuffers() {
+	// Temporary vectors of data
+	std::unordered_map< std::string, std::vector< GLfloat > > data = {
+		{ "position", std::vector< GLfloat >{} },
+		{ "color", std::vector< GLfloat >{} }
+	};
+
+	// Sides of each level
+	const GLint sides[] = { 4, 6, 8, 12, 16, 24, 32, 48 };
+
+	this->levels.clear();
+
+	for (const GLint& n : sides)
+	{
+		Level lvl;
+		lvl.first = static_cast<GLint>(data["position"].size() / 3);
+		lvl.vertices = n;
+
+		// A side of a circle of radius r is r * (1 - cos(pi / n)) inside it at its middle
+		lvl.maxRadius = tolerance / (1.0f - std::cos(static_cast<GLfloat>(M_PI) / n));
+
+		// A fan around the first vertex, no center or closing vertex needed
+		const GLfloat slice = M_PI * 2 / n;
+
+		for (GLint i = 0; i < n; i++)
+		{
+			data["position"].push_back(std::cos(i * slice));
+			data["position"].push_back(std::sin(i * slice));
+			data["position"].push_back(0.0f);
+
+			data["color"].push_back(1.0f);
+			data["color"].push_back(1.0f);
+			data["color"].push_back(1.0f);
+		}
+
+		this->levels.push_back(lvl);
+	}
+
+	// The finest level is as good as we get
+	this->levels.back().maxRadius = std::numeric_limits< GLfloat >::infinity();
+
+	this->numVertices = data["position"].size();
+
+	// Create our vertex array Object
+	glGenVertexArrays(1, &this->vao["main"]);
+
+	// Create and fill our position buffer
+	glGenBuffers(1, &this->buffer["position"]);
+	glBindBuffer(GL_ARRAY_BUFFER, this->buffer["position"]);
+	glBufferData(GL_ARRAY_BUFFER, data["position"].size() * sizeof(GLfloat), data["position"].data(), GL_STATIC_DRAW);
+
+	//Create and fill our color buffer
+	glGenBuffers(1, &this->buffer["color"]);
+	glBindBuffer(GL_ARRAY_BUFFER, this->buffer["color"]);
+	glBufferData(GL_ARRAY_BUFFER, data["color"].size() * sizeof(GLfloat), data["color"].data(), GL_STATIC_DRAW);
+
+	return *this;
+}
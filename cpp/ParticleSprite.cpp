@@ -0,0 +1,47 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include "../h/ParticleSprite.h"
+
+/**********************************************
+*
+*				OpenGL
+*
+***********************************************/
+ParticleSprite& ParticleSprite::compileShaders() {
+	// Shares the fragment shader with the circle mesh
+	this->program["simple"] = GLProgramCache::shared().get({
+	    {GL_VERTEX_SHADER, "glsl/quad.glsl"},
+	    {GL_FRAGMENT_SHADER, "glsl/fragment.glsl"}
+	});
+	return *this;
+}
+ParticleSprite& ParticleSprite::fillBuffers() {
+	// The corners come from gl_VertexID, only the VAO for the instances
+	glGenVertexArrays(1, &this->vao["main"]);
+
+	// A triangle strip of four vertices, counted in floats like the mesh
+	this->numVertices = 4 * 3;
+
+	return *this;
+}
+ParticleSprite& ParticleSprite::setVAOState() {
+	// Nothing per vertex, the renderer adds the per instance attributes
+	return *this;
+}
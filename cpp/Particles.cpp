@@ -18,149 +18,364 @@
   */
 
 #include <stdlib.h>
+#include <algorithm>
+#include <cstring>
 #include "../h/Particles.h"
 
 Particles& Particles::init() {
-    particles.reserve(numParticles);
+	TRACE_ZONE("Particles::init");
 
-	// Seed our random number generator
-	// We aren't dealing with secure communications
-	// So this will do fine
-    std::srand(std::time(0));
+	// Make room for the simulation state of every particle
+	// This is the only allocation, emitting and dying reuse the slots
+	this->store.reserve(this->numParticles);
+	this->reset.assign(this->numParticles, 0);
+	this->emitted = 0.0f;
 
-    // Fill our vector with particles
-	for (auto i = 0; i < this->numParticles; i++)
-	{
-		Particle particle;
-		this->particles.push_back(particle);
-	}
+	// Keep the seed we picked so the run can be recorded and repeated
+	if (this->seed == 0)
+		this->seed = static_cast<std::uint32_t>(std::time(0));
 
-	// For each particle
-	for (auto &p : this->particles)
-	{
-		// Set the radius of the particle randomly
-		p.radius = (std::rand() % this->maxRadius + this->minRadius) / 100.0f;
+	// Seed one random number stream per chunk
+	// The chunk index picks the stream so neighbouring chunks are unrelated
+	this->chunk = std::max< std::size_t >(1, this->chunkSize);
 
-		// Initialize the particle
-		// See the Particle::init()
-		p.init();
+	const std::uint32_t s = this->seed;
+	const std::size_t chunks = (this->store.capacity() + this->chunk - 1) / this->chunk;
 
-		// Set the initial position, and vertical and horizontal speed
-		this->resetParticle(p);
-	}
+	this->chunkRng.clear();
+	this->chunkRng.reserve(chunks);
+	this->chunkLive.assign(chunks, 0);
+
+	for (std::size_t c = 0; c < chunks; c++)
+		this->chunkRng.emplace_back(s, c);
+
+	this->morton.rewind();
+
+	// Emitters start empty and fill up in updatePosition()
+	if (this->emissionRate > 0.0f)
+		return *this;
+
+	this->store.grow(this->numParticles);
+
+	this->forEachChunk([this](const std::size_t& begin, const std::size_t& end) {
+		this->spawnRange(begin, end);
+	});
 
 	return *this;
 }
-Particles& Particles::resetParticle(Particle& p)
+Particles& Particles::resetParticle(const std::size_t& i)
 {
+	Random& rng = this->chunkRng[i / this->chunk];
+
 	// Set both the previous position and now position to our emitter point
-	p.position["now"].x = this->pos.x;
-	p.position["prev"].x = this->pos.x;
-	p.position["now"].y = this->pos.y;
-	p.position["prev"].y = this->pos.y;
+	this->store.posX[i] = this->pos.x;
+	this->store.prevX[i] = this->pos.x;
+	this->store.posY[i] = this->pos.y;
+	this->store.prevY[i] = this->pos.y;
 
 	// Set our velocity to zero so it has to start over
-	p.movement["vel"].x = 0;
-	p.movement["vel"].y = 0;
+	this->store.velX[i] = 0;
+	this->store.velY[i] = 0;
 
 	// Set our vertical and horizontal speeds randomly
-	p.movement["speed"].x = (std::rand() % this->maxSpeedX - (this->maxSpeedX / 2)) / 10.0f;
-	p.movement["speed"].y = (std::rand() % this->maxSpeedY + this->minSpeedY);
+	this->store.speedX[i] = rng.uniform(-this->maxSpeedX / 20.0f, this->maxSpeedX / 20.0f);
+	this->store.speedY[i] = rng.uniform(this->minSpeedY, this->minSpeedY + this->maxSpeedY);
+
+	// Start a new life
+	this->store.age[i] = 0.0f;
+
+	if (this->maxLifetime > 0.0f)
+		this->store.lifetime[i] = rng.uniform(this->minLifetime, this->maxLifetime);
+
+	return *this;
+}
+/**
+ * Emit count particles at once, as many as there are free slots for
+ * @param count
+ */
+Particles& Particles::burst(const std::size_t& count) {
+	const std::size_t begin = this->store.size();
+
+	this->store.grow(count);
+
+	// Each chunk draws from its own stream, see resetParticle()
+	for (std::size_t i = begin; i < this->store.size(); )
+	{
+		const std::size_t end = std::min(this->store.size(), (i / this->chunk + 1) * this->chunk);
+
+		std::fill(this->reset.begin() + i, this->reset.begin() + end, 0);
+		this->spawnRange(i, end);
+
+		i = end;
+	}
+
+	return *this;
+}
+/**
+ * Start particles [begin, end) of one chunk at the emitter
+ *   Like resetParticle() on each of them with a new radius, but every
+ *   value is drawn for the whole range at once
+ * @param begin
+ * @param end
+ */
+Particles& Particles::spawnRange(const std::size_t& begin, const std::size_t& end) {
+	Random& rng = this->chunkRng[begin / this->chunk];
+	ParticleStore& s = this->store;
+	const std::size_t n = end - begin;
+
+	// The radius is divided by 100.0f to get more variety in size
+	rng.fill(s.radius.data() + begin, n,
+		this->minRadius / 100.0f, (this->minRadius + this->maxRadius) / 100.0f);
+
+	rng.fill(s.speedX.data() + begin, n, -this->maxSpeedX / 20.0f, this->maxSpeedX / 20.0f);
+	rng.fill(s.speedY.data() + begin, n, this->minSpeedY, this->minSpeedY + this->maxSpeedY);
+
+	if (this->maxLifetime > 0.0f)
+		rng.fill(s.lifetime.data() + begin, n, this->minLifetime, this->maxLifetime);
+
+	std::fill(s.posX.data() + begin, s.posX.data() + end, this->pos.x);
+	std::fill(s.prevX.data() + begin, s.prevX.data() + end, this->pos.x);
+	std::fill(s.posY.data() + begin, s.posY.data() + end, this->pos.y);
+	std::fill(s.prevY.data() + begin, s.prevY.data() + end, this->pos.y);
+	std::fill(s.velX.data() + begin, s.velX.data() + end, 0.0f);
+	std::fill(s.velY.data() + begin, s.velY.data() + end, 0.0f);
+	std::fill(s.age.data() + begin, s.age.data() + end, 0.0f);
 
 	return *this;
 }
 
+/**
+ * Call fn(begin, end) for each chunk of particles
+ *   On the thread pool when there is one
+ */
+template <typename Fn>
+void Particles::forEachChunk(const Fn& fn) {
+	parallel_for(this->pool, this->store.size(), this->chunk, fn);
+}
+
 /**********************************************
 *
 *				Logic
 *
 ***********************************************/
-Particles& Particles::input(const SDL_Event& ev) {
-	return *this;
-}
-Particles& Particles::handleEdge() {
-	// for each particle
-	for (auto &p : this->particles)
+Particles& Particles::edgeRange(const std::size_t& begin, const std::size_t& end, const float& dt) {
+	ParticleStore& s = this->store;
+
+	// Bounce the particles off the screen bottom
+	// and mark the ones that are too slow or past the left and right edges
+	this->kernels->bounce(s.posX.data() + begin, s.posY.data() + begin,
+		s.velX.data() + begin, s.velY.data() + begin,
+		s.radius.data() + begin, this->reset.data() + begin,
+		end - begin, this->edge);
+
+	// Mark the particles that lived out their lifetime
+	if (this->maxLifetime > 0.0f)
 	{
-		// If the edge of the particle is below the screen bottom
-		if (p.position["now"].y - p.radius <= 10)
+		float* age = s.age.data();
+		const float* lifetime = s.lifetime.data();
+		std::uint8_t* flags = this->reset.data();
+
+		for (std::size_t i = begin; i < end; i++)
 		{
-			// Set the particle to rest on the screen bottom
-			p.position["now"].y = p.radius;
-
-			// Bounce the particle
-			// Reverse the vertical direction and slow down our vertical speed
-			p.movement["vel"].y *= -0.8f;
-			// Slow down our horizontal speed
-			p.movement["vel"].x *= 0.9f;
-
-			// Reset Slow Particles
-			if (abs(p.movement["vel"].x) < 50.0f && abs(p.movement["vel"].y < 50.0f))
-				this->resetParticle(p);
+			age[i] += dt;
+			flags[i] |= age[i] >= lifetime[i];
 		}
+	}
+
+	// Emitted particles die instead
+	// Pack the survivors at the front of the chunk while it is in cache
+	// and leave the holes for removeMarked()
+	if (this->emissionRate > 0.0f)
+	{
+		this->chunkLive[begin / this->chunk] = s.compact(begin, end, this->reset.data());
+		return *this;
+	}
+
+	// Reset the marked particles
+	// Most particles are not marked so skip 8 flags at a time
+	const std::uint8_t* flags = this->reset.data();
+	std::size_t i = begin;
+
+	for (; i + 8 <= end; i += 8)
+	{
+		std::uint64_t word;
+		std::memcpy(&word, flags + i, sizeof(word));
+
+		if (word == 0)
+			continue;
 
-		// Reset particle when past left and right screen edges
-		if (p.position["now"].x - p.radius > 800 || p.position["now"].x + p.radius < 0)
-			this->resetParticle(p);
+		for (std::size_t j = i; j < i + 8; j++)
+			if (flags[j])
+				this->resetParticle(j);
 	}
+
+	for (; i < end; i++)
+		if (flags[i])
+			this->resetParticle(i);
+
+	return *this;
+}
+/**
+ * Send the particles marked by edgeRange() back to the pool
+ *   Runs on one thread after the chunks are done since closing
+ *   the holes moves particles from the end of the store
+ */
+Particles& Particles::removeMarked() {
+	TRACE_ZONE("Particles::removeMarked");
+
+	if (this->emissionRate > 0.0f)
+		this->store.closeGaps(this->chunkLive.data(), this->chunk);
+
 	return *this;
 }
+/**
+ * Emit emissionRate particles per second
+ *   Fractions carry over so low rates still emit
+ */
+Particles& Particles::emit(const float& dt) {
+	if (this->emissionRate <= 0.0f)
+		return *this;
+
+	TRACE_ZONE("Particles::emit");
+
+	this->emitted += this->emissionRate * dt;
+
+	const float whole = std::floor(this->emitted);
+	this->emitted -= whole;
+
+	return this->burst(static_cast<std::size_t>(whole));
+}
+Particles& Particles::handleEdge() {
+	TRACE_ZONE("Particles::handleEdge");
+
+	this->forEachChunk([this](const std::size_t& begin, const std::size_t& end) {
+		this->edgeRange(begin, end, 0.0f);
+	});
+
+	return this->removeMarked();
+}
 Particles& Particles::handleMovement(const float& dt) {
-	// For each particle
-	for (auto &p : this->particles)
-	{
-		// Add the speed to our current velocity
-		// Multiplying the speed by deltaTime will allow us to
-		// Use speeds in pixels per second
-		p.movement["vel"].x += p.movement["speed"].x * dt;
-		p.movement["vel"].y += p.movement["speed"].y * dt;
-	}
+	ParticleStore& s = this->store;
+
+	// Add the speed to our current velocity
+	// Multiplying the speed by deltaTime will allow us to
+	// Use speeds in pixels per second
+	this->forEachChunk([&](const std::size_t& begin, const std::size_t& end) {
+		this->kernels->movement(s.velX.data() + begin, s.velY.data() + begin,
+			s.speedX.data() + begin, s.speedY.data() + begin,
+			end - begin, dt);
+	});
 
 	return *this;
 }
 Particles& Particles::addGravity(const float& dt) {
-	// for each particle
-	for (auto &p : this->particles)
-		// Remove speed due to gravity
-		p.movement["speed"].y -= this->gravity * dt;
+	float* speedY = this->store.speedY.data();
+	const float g = this->gravity * dt;
+
+	// Remove speed due to gravity
+	this->forEachChunk([&](const std::size_t& begin, const std::size_t& end) {
+		this->kernels->gravity(speedY + begin, end - begin, g);
+	});
 
 	return *this;
 }
 Particles& Particles::updatePosition(const float& dt) {
+	TRACE_ZONE("Particles::updatePosition");
 
-	this->handleMovement(dt)
-		.addGravity(dt);
+	ParticleStore& s = this->store;
+	const float g = this->gravity * dt;
 
-	// For each particle
-	for (auto &p : this->particles)
-	{
-		// Set the current position based on the previous position and add the velocity
+	// Each chunk goes through every step while it is still in cache
+	this->forEachChunk([&](const std::size_t& begin, const std::size_t& end) {
+		TRACE_ZONE("updatePosition chunk");
+
+		// Do handleMovement() and addGravity() then set the current position
+		// based on the previous position and the velocity, all in one pass
 		// Multiplying the velocity by deltaTime allows us to set velocity in pixels per second
-		p.position["now"].x = p.position["prev"].x + p.movement["vel"].x * dt;
-		p.position["now"].y = p.position["prev"].y + p.movement["vel"].y * dt;
-	}
+		if (this->forces)
+			this->forces(s, begin, end, dt);
+		else
+			this->kernels->step(s.posX.data() + begin, s.posY.data() + begin,
+				s.prevX.data() + begin, s.prevY.data() + begin,
+				s.velX.data() + begin, s.velY.data() + begin,
+				s.speedX.data() + begin, s.speedY.data() + begin,
+				end - begin, dt, g);
 
-	this->handleEdge();
+		this->edgeRange(begin, end, dt);
 
-	// For each particle
-	for (auto &p : this->particles)
 		// Set the previous position to the current position to test against on the next frame
-		p.position["prev"] = p.position["now"];
+		std::copy(s.posX.begin() + begin, s.posX.begin() + end, s.prevX.begin() + begin);
+		std::copy(s.posY.begin() + begin, s.posY.begin() + end, s.prevY.begin() + begin);
+	});
+
+	// Dead particles go back to the pool and new ones take their place
+	this->removeMarked().emit(dt);
+
+	// Keep particles that are close on screen close in memory
+	this->morton.step(this->store, this->pool, this->chunk);
 
 	return *this;
 }
 Particles& Particles::collisions() {
+	if (!this->collide)
+		return *this;
+
+	TRACE_ZONE("Particles::collisions");
+
+	// Cells as wide as the largest particle so only neighbouring cells can touch
+	const float cell = 2.0f * (this->maxRadius + this->minRadius) / 100.0f;
+
+	this->grid.collide(this->store, this->collision, cell, this->pool, this->chunk);
+
 	return *this;
 }
 Particles& Particles::interpolate(const float& dt, const float& ip) {
-	// For each particle
-	for (auto &p : this->particles)
-	{
-		// Do the same as in updatePosition() but utilize interpolation
-		// This is merely showing our particles in the correct place in time
-		p.position["now"].x = p.position["prev"].x + (p.movement["vel"].x * dt) * ip;
-		p.position["now"].y = p.position["prev"].y + (p.movement["vel"].y * dt) * ip;
-	}
+	TRACE_ZONE("Particles::interpolate");
+
+	ParticleStore& s = this->store;
+
+	// Do the same as in updatePosition() but utilize interpolation
+	// This is merely showing our particles in the correct place in time
+	this->forEachChunk([&](const std::size_t& begin, const std::size_t& end) {
+		this->kernels->integrate(s.posX.data() + begin, s.posY.data() + begin,
+			s.prevX.data() + begin, s.prevY.data() + begin,
+			s.velX.data() + begin, s.velY.data() + begin,
+			end - begin, dt * ip);
+	});
+
+	return *this;
+}
+/**
+ * Same as interpolate() but write the interpolated positions straight
+ * into out, one instance per particle, and leave the store alone
+ *   out can point at mapped GPU memory
+ */
+Particles& Particles::interpolate(const float& dt, const float& ip, ParticleInstance* out) {
+	this->interpolate(this->store, dt, ip, out, this->pool);
+
+	return *this;
+}
+/**
+ * Same again from another store with our color and kernels
+ *   Lets a render thread draw a Snapshot while this one is updated
+ *   on another thread, and so with threads other than our pool
+ */
+const Particles& Particles::interpolate(const ParticleStore& from, const float& dt, const float& ip,
+	ParticleInstance* out, ThreadPool* threads) const {
+	TRACE_ZONE("Particles::interpolate");
+
+	const ParticleStore& s = from;
+
+	parallel_for(threads, s.size(), this->chunk, [&](const std::size_t& begin, const std::size_t& end) {
+		TRACE_ZONE("interpolate chunk");
+
+		this->kernels->instances(out + begin,
+			s.prevX.data() + begin, s.prevY.data() + begin,
+			s.velX.data() + begin, s.velY.data() + begin,
+			s.radius.data() + begin, end - begin,
+			dt * ip, this->color);
+	});
+
 	return *this;
 }
 
@@ -169,10 +384,17 @@ Particles& Particles::interpolate(const float& dt, const float& ip) {
 *				Draw
 *
 ***********************************************/
-Particles& Particles::draw() {
-	// For each particle, draw
-	for (auto &p : this->particles)
-		p.draw();
+Particles& Particles::writeInstances(ParticleInstance* out) {
+	TRACE_ZONE("Particles::writeInstances");
+
+	ParticleStore& s = this->store;
+	const std::uint32_t c = this->color;
+
+	// Pack what the renderer needs, one instance per particle
+	this->forEachChunk([&](const std::size_t& begin, const std::size_t& end) {
+		for (std::size_t i = begin; i < end; i++)
+			out[i] = ParticleInstance{ s.posX[i], s.posY[i], s.radius[i], c };
+	});
 
 	return *this;
 }
@@ -0,0 +1,546 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+
+#include "../h/ParticlesRenderer.h"
+
+ParticlesRenderer::~ParticlesRenderer() {
+	glDeleteBuffers(1, &this->instanceBuffer);
+}
+
+ParticlesRenderer& ParticlesRenderer::init(const Particles& ps) {
+	return this->init(ps.store.capacity());
+}
+ParticlesRenderer& ParticlesRenderer::init(const EmitterSystem& es) {
+	return this->init(es.store.capacity());
+}
+ParticlesRenderer& ParticlesRenderer::init(const std::size_t& capacity) {
+	// A circle of radius 1 at the origin, or a quad around it
+	// The vertex shader scales and moves it for each instance
+	this->mesh().radius = 1.0f;
+
+	// See the Particle::init()
+	this->mesh().init();
+
+	// The quad is one level, the circle mesh has several, see ParticleLOD
+	if (this->sprites)
+		this->levels.assign(1, ParticleLOD::Level{ 0, 4, std::numeric_limits< GLfloat >::infinity() });
+	else
+		this->levels = this->circle.levels;
+
+	// Stream instances through persistently mapped memory when we can
+	// else fall back to refilling an orphaned buffer every draw
+	// Room for the whole pool so emitting more particles never remaps
+	this->persistent = StreamBuffer::supported() && this->reserve(capacity);
+
+	if (!this->persistent)
+		this->useInstanceBuffer();
+
+	return *this;
+}
+
+/**********************************************
+*
+*				OpenGL
+*
+***********************************************/
+bool ParticlesRenderer::reserve(const std::size_t& count) {
+	const GLsizeiptr bytes = count * sizeof(ParticleInstance);
+
+	if (this->stream.buffer != 0 && bytes <= this->stream.capacity())
+		return true;
+
+	// Leave room to grow so a few more particles do not remap every frame
+	// Regions hold whole instances so each one starts on an instance index
+	const std::size_t capacity = count + count / 2 + 1;
+
+	if (!this->stream.init(capacity * sizeof(ParticleInstance)))
+		return false;
+
+	this->setInstanceState(this->stream.buffer);
+
+	return true;
+}
+ParticlesRenderer& ParticlesRenderer::useInstanceBuffer() {
+	this->persistent = false;
+
+	if (this->instanceBuffer == 0)
+		glGenBuffers(1, &this->instanceBuffer);
+
+	this->setInstanceState(this->instanceBuffer);
+
+	return *this;
+}
+ParticlesRenderer& ParticlesRenderer::setInstanceState(const GLuint& buffer) {
+	TRACE_ZONE("ParticlesRenderer::setInstanceState");
+
+	GLuint prg = this->mesh().program["simple"].program();
+
+	// Get the names of the per instance attributes in our shader program
+	this->mesh().attr["offset"] = glGetAttribLocation(prg, "offset");
+	this->mesh().attr["radius"] = glGetAttribLocation(prg, "radius");
+	this->mesh().attr["instanceColor"] = glGetAttribLocation(prg, "instanceColor");
+
+	const GLsizei stride = sizeof(ParticleInstance);
+
+	this->boundBuffer = buffer;
+
+	// Add the instance buffer to the mesh's VAO
+	// A divisor of 1 moves to the next instance once per circle instead of once per vertex
+	glBindVertexArray(this->mesh().vao["main"]);
+	    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	    glEnableVertexAttribArray(this->mesh().attr["offset"]);
+	    glVertexAttribPointer(this->mesh().attr["offset"], 2, GL_FLOAT, GL_FALSE, stride,
+	        (const GLvoid*)offsetof(ParticleInstance, x));
+	    glVertexAttribDivisor(this->mesh().attr["offset"], 1);
+
+	    glEnableVertexAttribArray(this->mesh().attr["radius"]);
+	    glVertexAttribPointer(this->mesh().attr["radius"], 1, GL_FLOAT, GL_FALSE, stride,
+	        (const GLvoid*)offsetof(ParticleInstance, radius));
+	    glVertexAttribDivisor(this->mesh().attr["radius"], 1);
+
+	    glEnableVertexAttribArray(this->mesh().attr["instanceColor"]);
+	    glVertexAttribPointer(this->mesh().attr["instanceColor"], 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+	        (const GLvoid*)offsetof(ParticleInstance, color));
+	    glVertexAttribDivisor(this->mesh().attr["instanceColor"], 1);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return *this;
+}
+ParticlesRenderer& ParticlesRenderer::upload(Particles& ps) {
+	// Never persistent here, so this is our vector or the staging for endWrite()
+	ParticleInstance* out = this->beginWrite(ps.store.size(), ps.store.capacity());
+	ps.writeInstances(out);
+
+	return this->endWrite(ps.store.size(), ps.store.capacity());
+}
+ParticlesRenderer& ParticlesRenderer::uploadInstances() {
+	TRACE_ZONE("ParticlesRenderer::uploadInstances");
+
+	const GLsizeiptr bytes = this->instances.size() * sizeof(ParticleInstance);
+
+	// Orphan the old storage so we never wait on a draw that still reads it
+	glBindBuffer(GL_ARRAY_BUFFER, this->instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, this->instances.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return *this;
+}
+
+/**********************************************
+*
+*				Logic
+*
+***********************************************/
+ParticlesRenderer& ParticlesRenderer::interpolate(Particles& ps, const float& dt, const float& ip) {
+	if (this->persistent && !this->reserve(ps.store.size()))
+		this->useInstanceBuffer();
+
+	if (!this->persistent)
+	{
+		// The store is uploaded in draw()
+		ps.interpolate(dt, ip);
+		return *this;
+	}
+
+	// Write the interpolated positions straight into the region the GPU reads next,
+	// or into the staging when they are sorted into levels after
+	// Only waits if the GPU is still reading it from three draws ago
+	ParticleInstance* out = this->beginWrite(ps.store.size(), ps.store.capacity());
+	ps.interpolate(dt, ip, out);
+
+	return this->endWrite(ps.store.size(), ps.store.capacity());
+}
+ParticlesRenderer& ParticlesRenderer::interpolate(EmitterSystem& es, const float& dt, const float& ip) {
+	// The instances are grouped by material so they can not be
+	// interpolated in place, write them where the draw reads them
+	ParticleInstance* out = this->beginWrite(es.store.size(), es.store.capacity());
+	es.interpolate(dt, ip, out);
+
+	return this->endWrite(es.store.size(), es.store.capacity(), &es.ranges());
+}
+/**
+ * Write the instances of the last tick the simulation thread published
+ *   On this thread, the pool belongs to the simulation
+ */
+ParticlesRenderer& ParticlesRenderer::interpolate(const Particles& ps, const Snapshot& snap, const float& ip) {
+	ParticleInstance* out = this->beginWrite(snap.store.size(), snap.store.capacity());
+	ps.interpolate(snap.store, snap.dt, ip, out, nullptr);
+
+	return this->endWrite(snap.store.size(), snap.store.capacity());
+}
+ParticlesRenderer& ParticlesRenderer::interpolate(EmitterSystem& es, const Snapshot& snap, const float& ip) {
+	ParticleInstance* out = this->beginWrite(snap.store.size(), snap.store.capacity());
+	es.interpolate(snap.store, snap.dt, ip, out, nullptr);
+
+	return this->endWrite(snap.store.size(), snap.store.capacity(), &es.ranges());
+}
+/**
+ * Where to write count instances for the next draw
+ *   The staging vector when they are culled or sorted into levels
+ *   after, else where the draw reads them, see destination()
+ */
+ParticleInstance* ParticlesRenderer::beginWrite(const std::size_t& count, const std::size_t& capacity) {
+	if (this->persistent && !this->reserve(count))
+		this->useInstanceBuffer();
+
+	if (this->levels.size() == 1 && !this->cull)
+		return this->destination(count, capacity);
+
+	this->staging.reserve(capacity);
+	this->staging.resize(count);
+
+	return this->staging.data();
+}
+/**
+ * Where the draw reads count instances from
+ *   The mapped region when we have one, else our vector
+ *   sized for capacity once so it never reallocates
+ */
+ParticleInstance* ParticlesRenderer::destination(const std::size_t& count, const std::size_t& capacity) {
+	if (this->persistent)
+		return static_cast<ParticleInstance*>(this->stream.map());
+
+	this->instances.reserve(capacity);
+	this->instances.resize(count);
+
+	return this->instances.data();
+}
+/**
+ * Finish what beginWrite() started
+ *   ranges are the instances of each material, one material without them
+ */
+ParticlesRenderer& ParticlesRenderer::endWrite(const std::size_t& count, const std::size_t& capacity,
+	const std::vector< std::size_t >* ranges) {
+	this->drawCount = count;
+	this->culled = 0;
+
+	if (ranges != nullptr)
+		this->drawRanges = *ranges;
+	else
+		this->drawRanges.assign({ 0, count });
+
+	// In place when they are sorted after
+	if (this->cull)
+		this->cullInstances(this->levels.size() > 1 ?
+			this->staging.data() : this->destination(count, capacity));
+
+	if (this->levels.size() > 1)
+		this->sortLevels(this->destination(this->drawCount, capacity));
+
+	if (!this->persistent)
+	{
+		// Only what is left is uploaded
+		this->instances.resize(this->drawCount);
+		this->uploadInstances();
+	}
+
+	return *this;
+}
+/**
+ * Compact the staged instances that can be seen into out
+ *   One flag per instance is set with no branches so the test
+ *   vectorizes. The flags are counted in blocks, and a prefix sum
+ *   over the counts is where each block's instances go, so drawRanges
+ *   are remapped without another pass and each block is compacted on
+ *   its own. A block with nothing culled is one copy
+ *   out can be the staging itself, nothing moves forward
+ */
+ParticlesRenderer& ParticlesRenderer::cullInstances(ParticleInstance* out) {
+	TRACE_ZONE("ParticlesRenderer::cullInstances");
+
+	const std::size_t n = this->drawCount;
+	const ParticleInstance* in = this->staging.data();
+	Particle& mesh = this->mesh();
+
+	// Where the plane of the particles lands in clip space, see Particle::updateGL()
+	// clip = a * x + b * y + c, and the viewport is -1 to 1 on both axes
+	const glm::mat4 m = mesh.MVP["ortho"] * mesh.MVP["view"] * mesh.MVP["model"];
+	const GLfloat ax = m[0][0], bx = m[1][0], cx = m[3][0];
+	const GLfloat ay = m[0][1], by = m[1][1], cy = m[3][1];
+
+	// How far a radius of 1 reaches in clip space on each axis
+	const GLfloat rx = std::sqrt(ax * ax + bx * bx);
+	const GLfloat ry = std::sqrt(ay * ay + by * by);
+
+	// and in pixels, the viewport is 2 wide in clip space
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	const GLfloat pixels = 0.5f * std::min(rx * viewport[2], ry * viewport[3]);
+	const GLfloat minRadius = this->minPixels / pixels;
+
+	this->visible.resize(n);
+	std::uint8_t* flags = this->visible.data();
+
+	// Seen when its bounds overlap the viewport, NaNs are not
+	for (std::size_t i = 0; i < n; i++)
+	{
+		const GLfloat x = ax * in[i].x + bx * in[i].y + cx;
+		const GLfloat y = ay * in[i].x + by * in[i].y + cy;
+		const GLfloat r = in[i].radius;
+
+		flags[i] = (std::fabs(x) <= 1.0f + r * rx) & (std::fabs(y) <= 1.0f + r * ry) & (r >= minRadius);
+	}
+
+	// Count each block and turn the counts into where each block starts
+	const std::size_t blocks = (n + cullBlock - 1) / cullBlock;
+	this->blockOffsets.resize(blocks + 1);
+
+	std::size_t offset = 0;
+
+	for (std::size_t b = 0; b < blocks; b++)
+	{
+		const std::size_t end = std::min((b + 1) * cullBlock, n);
+		std::size_t seen = 0;
+
+		for (std::size_t i = b * cullBlock; i < end; i++)
+			seen += flags[i];
+
+		this->blockOffsets[b] = offset;
+		offset += seen;
+	}
+
+	this->blockOffsets[blocks] = offset;
+
+	// A range starts where its block does plus what is seen before it in the block
+	for (std::size_t& r : this->drawRanges)
+	{
+		const std::size_t b = r / cullBlock;
+		std::size_t start = this->blockOffsets[b];
+
+		for (std::size_t i = b * cullBlock; i < r; i++)
+			start += flags[i];
+
+		r = start;
+	}
+
+	for (std::size_t b = 0; b < blocks; b++)
+	{
+		const std::size_t begin = b * cullBlock;
+		const std::size_t end = std::min(begin + cullBlock, n);
+		const std::size_t seen = this->blockOffsets[b + 1] - this->blockOffsets[b];
+		ParticleInstance* dst = out + this->blockOffsets[b];
+
+		if (seen == end - begin)
+		{
+			if (dst != in + begin)
+				std::memmove(dst, in + begin, seen * sizeof(ParticleInstance));
+
+			continue;
+		}
+
+		for (std::size_t i = begin; i < end; i++)
+			if (flags[i])
+				*dst++ = in[i];
+	}
+
+	this->drawCount = offset;
+	this->culled = n - offset;
+
+	return *this;
+}
+/**
+ * Copy the staged instances to out, each material sorted by level
+ *   drawRanges become one range per level of each material
+ */
+ParticlesRenderer& ParticlesRenderer::sortLevels(ParticleInstance* out) {
+	TRACE_ZONE("ParticlesRenderer::sortLevels");
+
+	const std::size_t levels = this->levels.size();
+	const std::size_t materials = this->drawRanges.size() - 1;
+	const ParticleInstance* in = this->staging.data();
+
+	// Count each level of each material
+	this->levelRanges.assign(materials * levels + 1, 0);
+
+	for (std::size_t m = 0; m < materials; m++)
+		for (std::size_t i = this->drawRanges[m]; i < this->drawRanges[m + 1]; i++)
+			this->levelRanges[m * levels + this->circle.level(in[i].radius)]++;
+
+	// Turn the counts into where each level starts
+	std::size_t offset = 0;
+
+	for (std::size_t& r : this->levelRanges)
+	{
+		const std::size_t n = r;
+		r = offset;
+		offset += n;
+	}
+
+	// Scatter, the cursors end where the next level starts
+	this->levelCursors.assign(this->levelRanges.begin(), this->levelRanges.end() - 1);
+
+	for (std::size_t m = 0; m < materials; m++)
+		for (std::size_t i = this->drawRanges[m]; i < this->drawRanges[m + 1]; i++)
+			out[this->levelCursors[m * levels + this->circle.level(in[i].radius)]++] = in[i];
+
+	this->drawRanges.swap(this->levelRanges);
+
+	return *this;
+}
+
+/**********************************************
+*
+*				Draw
+*
+***********************************************/
+ParticlesRenderer& ParticlesRenderer::draw(Particles& ps) {
+	if (!this->persistent)
+		this->upload(ps);
+
+	return this->drawWritten();
+}
+/**
+ * Draw the instances the last interpolate() wrote, in one material
+ */
+ParticlesRenderer& ParticlesRenderer::drawWritten() {
+	this->bindInstances();
+
+	// The base instance points the instance attributes at the region we just wrote
+	const GLuint baseInstance = this->persistent ?
+		this->stream.offset() / sizeof(ParticleInstance) : 0;
+
+	this->drawInstances(baseInstance, this->drawRanges, this->levels.size());
+
+	// The GPU is done with this region once the draw completes
+	if (this->persistent)
+		this->stream.fence();
+
+	return *this;
+}
+ParticlesRenderer& ParticlesRenderer::draw(ComputeParticles& cps) {
+	// The compute shader already wrote the instances, see ComputeParticles::interpolate()
+	if (this->boundBuffer != cps.instanceBuffer())
+		this->setInstanceState(cps.instanceBuffer());
+
+	this->drawCount = cps.numParticles;
+	this->culled = 0;
+
+	// Written on the GPU so not sorted into levels, all drawn with the finest
+	this->drawRanges.assign({ 0, this->drawCount });
+	return this->drawInstances(0, this->drawRanges, 1);
+}
+ParticlesRenderer& ParticlesRenderer::draw(EmitterSystem& es) {
+	// Nothing was interpolated yet
+	if (es.ranges().empty())
+		return *this;
+
+	// Uploaded or written in interpolate()
+	this->bindInstances();
+
+	const GLuint baseInstance = this->persistent ?
+		this->stream.offset() / sizeof(ParticleInstance) : 0;
+
+	// One draw per level of each material, see EmitterSystem::ranges() and sortLevels()
+	this->drawInstances(baseInstance, this->drawRanges, this->levels.size());
+
+	if (this->persistent)
+		this->stream.fence();
+
+	return *this;
+}
+/**
+ * What each particle is drawn from, see sprites
+ */
+Particle& ParticlesRenderer::mesh() {
+	if (this->sprites)
+		return this->sprite;
+
+	return this->circle;
+}
+/**
+ * Point the mesh's VAO at the buffer the CPU writes instances into
+ */
+ParticlesRenderer& ParticlesRenderer::bindInstances() {
+	const GLuint buffer = this->persistent ? this->stream.buffer : this->instanceBuffer;
+
+	if (this->boundBuffer != buffer)
+		this->setInstanceState(buffer);
+
+	return *this;
+}
+/**
+ * Draw the instances of each level of each material
+ *   Level l of material m is instances [ranges[g], ranges[g + 1])
+ *   of g = m * levelsPerMaterial + l. With one level per material
+ *   they are drawn with the finest
+ */
+ParticlesRenderer& ParticlesRenderer::drawInstances(const GLuint& baseInstance,
+	const std::vector< std::size_t >& ranges, const std::size_t& levelsPerMaterial) {
+	TRACE_ZONE("ParticlesRenderer::drawInstances");
+
+	// Start using our program
+	this->mesh().program["simple"].program_start();
+
+	// Set the OpenGL server state
+	glBindVertexArray(this->mesh().vao["main"]);
+
+	// Send our MVP to the OpenGL server
+	// The mesh sits at the origin so the model matrix is the identity
+	this->mesh().updateGL();
+
+	for (std::size_t g = 0; g + 1 < ranges.size(); g++)
+	{
+		const GLsizei count = static_cast<GLsizei>(ranges[g + 1] - ranges[g]);
+
+		if (count == 0)
+			continue;
+
+		const std::size_t m = g / levelsPerMaterial;
+		const ParticleLOD::Level& lvl = levelsPerMaterial == 1 ?
+			this->levels.back() : this->levels[g % levelsPerMaterial];
+
+		const Material& mat = this->materials[std::min(m, this->materials.size() - 1)];
+
+		if (mat.blend)
+		{
+			glEnable(GL_BLEND);
+			glBlendFunc(mat.src, mat.dst);
+		}
+		else if (this->sprites)
+		{
+			// Solid, but the anti-aliased edge goes over what is behind it
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+		}
+		else
+			glDisable(GL_BLEND);
+
+		// Draw every particle of the level in one call
+		glDrawArraysInstancedBaseInstance(this->sprites ? GL_TRIANGLE_STRIP : GL_TRIANGLE_FAN,
+			lvl.first, lvl.vertices, count, baseInstance + static_cast<GLuint>(ranges[g]));
+	}
+
+	glDisable(GL_BLEND);
+
+	// Unbind the VAO and stop using the program so other objects
+	// can use the server
+	glBindVertexArray(0);
+	this->mesh().program["simple"].program_stop();
+
+	return *this;
+}
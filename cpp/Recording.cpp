@@ -0,0 +1,431 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+
+#include "../h/Recording.h"
+
+namespace {
+
+const char magic[4] = { 'P', 'R', 'E', 'C' };
+
+// Writes each value it is given
+// Sizes are written as 64 bits so a recording reads the same on 32 bit builds
+// and flags as one byte, 0 or 1
+struct Writer {
+	std::ofstream& out;
+
+	template <typename T>
+	void operator()(const T& value) {
+		if constexpr (std::is_same< T, std::size_t >::value)
+		{
+			const std::uint64_t wide = value;
+			this->out.write(reinterpret_cast<const char*>(&wide), sizeof(wide));
+		}
+		else if constexpr (std::is_same< T, bool >::value)
+		{
+			const std::uint8_t byte = value ? 1 : 0;
+			this->out.write(reinterpret_cast<const char*>(&byte), sizeof(byte));
+		}
+		else
+			this->out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+};
+
+// Reads each value it is given, in the order the Writer wrote them
+// A flag that is not 0 or 1 fails the stream, copying any other byte
+// into a bool is undefined
+struct Reader {
+	std::ifstream& in;
+
+	template <typename T>
+	void operator()(T& value) {
+		if constexpr (std::is_same< T, std::size_t >::value)
+		{
+			std::uint64_t wide = 0;
+			this->in.read(reinterpret_cast<char*>(&wide), sizeof(wide));
+			value = static_cast<std::size_t>(wide);
+		}
+		else if constexpr (std::is_same< T, bool >::value)
+		{
+			std::uint8_t byte = 0;
+			this->in.read(reinterpret_cast<char*>(&byte), sizeof(byte));
+
+			if (byte > 1)
+			{
+				std::cout << "Invalid flag " << static_cast<int>(byte) << " in the recording\n";
+				this->in.setstate(std::ios::failbit);
+			}
+
+			value = byte == 1;
+		}
+		else
+			this->in.read(reinterpret_cast<char*>(&value), sizeof(value));
+	}
+};
+
+// The values that make two runs simulate the same thing
+// One list for writing and reading so the two can not drift apart
+// Changing what is in here means a new Recorder::version
+template <typename IO, typename P>
+void fields(IO& io, P& ps) {
+	io(ps.numParticles);
+	io(ps.seed);
+	io(ps.chunkSize);
+	io(ps.pos.x);
+	io(ps.pos.y);
+	io(ps.color);
+	io(ps.emissionRate);
+	io(ps.minLifetime);
+	io(ps.maxLifetime);
+	io(ps.maxRadius);
+	io(ps.minRadius);
+	io(ps.gravity);
+	io(ps.maxSpeedX);
+	io(ps.minSpeedY);
+	io(ps.maxSpeedY);
+	io(ps.collide);
+	io(ps.collision.restitution);
+	io(ps.collision.separation);
+}
+
+template <typename IO, typename E>
+void emitterFields(IO& io, E& em) {
+	io(em.pos.x);
+	io(em.pos.y);
+	io(em.color);
+	io(em.maxRadius);
+	io(em.minRadius);
+	io(em.gravity);
+	io(em.maxSpeedX);
+	io(em.minSpeedY);
+	io(em.maxSpeedY);
+	io(em.emissionRate);
+	io(em.minLifetime);
+	io(em.maxLifetime);
+	io(em.material);
+	io(em.seed);
+}
+
+template <typename IO, typename S>
+void systemFields(IO& io, S& es) {
+	io(es.numParticles);
+	io(es.seed);
+	io(es.chunkSize);
+	io(es.collide);
+	io(es.collision.restitution);
+	io(es.collision.separation);
+}
+
+// Since version 2, after the edge
+template <typename IO, typename P>
+void orderFields(IO& io, P& ps) {
+	io(ps.morton.slices);
+}
+
+template <typename IO, typename Edge>
+void edgeFields(IO& io, Edge& edge) {
+	io(edge.floor);
+	io(edge.left);
+	io(edge.right);
+	io(edge.bounce);
+	io(edge.friction);
+	io(edge.slow);
+}
+
+}
+
+/**********************************************
+*
+*				Recorder
+*
+***********************************************/
+Recorder::~Recorder() {
+	this->close();
+}
+bool Recorder::open(const std::string& path) {
+	this->close();
+
+	this->out.open(path, std::ios::binary | std::ios::trunc);
+
+	if (!this->out)
+	{
+		std::cout << "Could not write the recording " << path << "\n";
+		return false;
+	}
+
+	Writer w{ this->out };
+
+	this->out.write(magic, sizeof(magic));
+	w(version);
+
+	return true;
+}
+bool Recorder::isOpen() const {
+	return this->out.is_open();
+}
+Recorder& Recorder::setup(const Particles& ps) {
+	if (!this->isOpen())
+		return *this;
+
+	Writer w{ this->out };
+
+	w(RecordKind::Particles);
+	fields(w, ps);
+	edgeFields(w, ps.edge);
+	orderFields(w, ps);
+
+	// SIMD kernels round differently from the scalar ones
+	const std::uint8_t length = static_cast<std::uint8_t>(std::strlen(ps.kernels->name));
+	w(length);
+	this->out.write(ps.kernels->name, length);
+
+	return *this;
+}
+Recorder& Recorder::setup(const EmitterSystem& es) {
+	if (!this->isOpen())
+		return *this;
+
+	Writer w{ this->out };
+
+	w(RecordKind::Emitters);
+	systemFields(w, es);
+	edgeFields(w, es.edge);
+	orderFields(w, es);
+
+	const std::uint8_t length = static_cast<std::uint8_t>(std::strlen(es.kernels->name));
+	w(length);
+	this->out.write(es.kernels->name, length);
+
+	const std::uint32_t count = static_cast<std::uint32_t>(es.emitters().size());
+	w(count);
+
+	for (const Emitter& em : es.emitters())
+		emitterFields(w, em);
+
+	return *this;
+}
+Recorder& Recorder::tick(const float& dt) {
+	std::lock_guard< std::mutex > guard(this->lock);
+
+	if (!this->isOpen())
+		return *this;
+
+	// Add to the run of ticks when dt did not change
+	if (this->runCount > 0 && dt != this->runDt)
+		this->flushTicks();
+
+	this->runDt = dt;
+	this->runCount++;
+
+	return *this;
+}
+Recorder& Recorder::input(const std::uint32_t& type, const std::int32_t& code) {
+	std::lock_guard< std::mutex > guard(this->lock);
+
+	if (!this->isOpen())
+		return *this;
+
+	// Before the ticks it comes after
+	this->flushTicks();
+
+	Writer w{ this->out };
+
+	w(RecordKind::Input);
+	w(type);
+	w(code);
+
+	return *this;
+}
+Recorder& Recorder::checksum(const ParticleStore& store) {
+	std::lock_guard< std::mutex > guard(this->lock);
+
+	if (!this->isOpen() || !this->checksums)
+		return *this;
+
+	this->flushTicks();
+
+	Writer w{ this->out };
+
+	w(RecordKind::Checksum);
+	w(store.checksum());
+
+	return *this;
+}
+Recorder& Recorder::close() {
+	std::lock_guard< std::mutex > guard(this->lock);
+
+	if (!this->isOpen())
+		return *this;
+
+	this->flushTicks();
+
+	Writer w{ this->out };
+	w(RecordKind::End);
+
+	this->out.close();
+
+	return *this;
+}
+Recorder& Recorder::flushTicks() {
+	if (this->runCount == 0)
+		return *this;
+
+	Writer w{ this->out };
+
+	w(RecordKind::Ticks);
+	w(this->runCount);
+	w(this->runDt);
+
+	this->runCount = 0;
+
+	return *this;
+}
+
+/**********************************************
+*
+*				Replay
+*
+***********************************************/
+bool Replay::open(const std::string& path) {
+	this->in.open(path, std::ios::binary);
+
+	if (!this->in)
+	{
+		std::cout << "Could not read the recording " << path << "\n";
+		return false;
+	}
+
+	char header[sizeof(magic)] = {};
+	this->in.read(header, sizeof(header));
+
+	if (!this->in || std::memcmp(header, magic, sizeof(magic)) != 0)
+	{
+		std::cout << path << " is not a recording\n";
+		return false;
+	}
+
+	Reader r{ this->in };
+	r(this->version);
+
+	if (!this->in || this->version == 0 || this->version > Recorder::version)
+	{
+		std::cout << path << " is version " << this->version <<
+			", this build reads up to version " << Recorder::version << "\n";
+		return false;
+	}
+
+	return true;
+}
+bool Replay::next(Record& record) {
+	Reader r{ this->in };
+
+	record.kind = RecordKind::End;
+	r(record.kind);
+
+	if (!this->in)
+		return false;
+
+	switch (record.kind)
+	{
+		case RecordKind::Particles:
+		{
+			fields(r, this->particles);
+			edgeFields(r, this->particles.edge);
+
+			if (this->version >= 2)
+				orderFields(r, this->particles);
+
+			if (!this->readKernels())
+				return false;
+
+			this->particles.kernels = &ParticleKernels::get(this->kernels);
+			break;
+		}
+		case RecordKind::Emitters:
+		{
+			systemFields(r, this->system);
+			edgeFields(r, this->system.edge);
+
+			if (this->version >= 2)
+				orderFields(r, this->system);
+
+			if (!this->readKernels())
+				return false;
+
+			this->system.kernels = &ParticleKernels::get(this->kernels);
+
+			std::uint32_t count = 0;
+			r(count);
+
+			for (std::uint32_t e = 0; e < count && this->in; e++)
+			{
+				Emitter em;
+				emitterFields(r, em);
+
+				if (this->system.add(em) == EmitterSystem::noEmitter)
+				{
+					std::cout << "More than " << EmitterSystem::maxEmitters << " emitters in the recording\n";
+					return false;
+				}
+			}
+			break;
+		}
+		case RecordKind::Ticks:
+		{
+			r(record.count);
+			r(record.dt);
+			break;
+		}
+		case RecordKind::Input:
+		{
+			r(record.type);
+			r(record.code);
+			break;
+		}
+		case RecordKind::Checksum:
+		{
+			r(record.checksum);
+			break;
+		}
+		case RecordKind::End:
+			return false;
+		default:
+		{
+			std::cout << "Unknown record " << static_cast<int>(record.kind) << " in the recording\n";
+			return false;
+		}
+	}
+
+	// Cut short in the middle of a record
+	return static_cast<bool>(this->in);
+}
+bool Replay::readKernels() {
+	Reader r{ this->in };
+
+	std::uint8_t length = 0;
+	r(length);
+
+	this->kernels.assign(length, '\0');
+	this->in.read(&this->kernels[0], length);
+
+	return static_cast<bool>(this->in);
+}
@@ -0,0 +1,309 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <algorithm>
+#include <limits>
+
+#include "../h/SpatialGrid.h"
+
+SpatialGrid& SpatialGrid::build(const float* x, const float* y, const std::size_t& n,
+	const float& cell, ThreadPool* pool, const std::size_t& chunk) {
+	TRACE_ZONE("SpatialGrid::build");
+
+	this->cellSize = cell;
+	this->invCellSize = 1.0f / cell;
+
+	// The bounding box of the particles, each chunk then all of them
+	const std::size_t chunks = std::max< std::size_t >(1, (n + chunk - 1) / chunk);
+	this->chunkBounds.assign(chunks * 4, 0.0f);
+
+	parallel_for(pool, n, chunk, [&](const std::size_t& begin, const std::size_t& end) {
+		float lo[2] = { x[begin], y[begin] };
+		float hi[2] = { x[begin], y[begin] };
+
+		for (std::size_t i = begin; i < end; i++)
+		{
+			lo[0] = std::min(lo[0], x[i]);
+			lo[1] = std::min(lo[1], y[i]);
+			hi[0] = std::max(hi[0], x[i]);
+			hi[1] = std::max(hi[1], y[i]);
+		}
+
+		float* bounds = this->chunkBounds.data() + begin / chunk * 4;
+		bounds[0] = lo[0];
+		bounds[1] = lo[1];
+		bounds[2] = hi[0];
+		bounds[3] = hi[1];
+	});
+
+	float lo[2] = { this->chunkBounds[0], this->chunkBounds[1] };
+	float hi[2] = { this->chunkBounds[2], this->chunkBounds[3] };
+
+	for (std::size_t c = 1; c < chunks && n > 0; c++)
+	{
+		lo[0] = std::min(lo[0], this->chunkBounds[c * 4]);
+		lo[1] = std::min(lo[1], this->chunkBounds[c * 4 + 1]);
+		hi[0] = std::max(hi[0], this->chunkBounds[c * 4 + 2]);
+		hi[1] = std::max(hi[1], this->chunkBounds[c * 4 + 3]);
+	}
+
+	this->minCX = this->cellOf(lo[0]);
+	this->minCY = this->cellOf(lo[1]);
+	this->columns = this->cellOf(hi[0]) - this->minCX + 1;
+	this->rows = this->cellOf(hi[1]) - this->minCY + 1;
+
+	// Number the cells of the box when there are not many more cells than particles
+	// else hash them into a power of two of at least 2 buckets per particle
+	std::size_t buckets;
+	const double cells = static_cast<double>(this->columns) * this->rows;
+
+	if (cells <= 4.0 * n + 64)
+	{
+		buckets = static_cast<std::size_t>(cells);
+		this->mask = 0;
+	}
+	else
+	{
+		buckets = 2;
+		while (buckets < 2 * n)
+			buckets <<= 1;
+
+		this->mask = static_cast<std::uint32_t>(buckets - 1);
+	}
+
+	this->bucketStart.resize(buckets + 1);
+	this->bucketOf.resize(n);
+	this->keysOut.resize(n);
+	this->particles.resize(n);
+	this->particlesOut.resize(n);
+
+	std::uint32_t* keys = this->bucketOf.data();
+	std::uint32_t* order = this->particles.data();
+
+	parallel_for(pool, n, chunk, [&](const std::size_t& begin, const std::size_t& end) {
+		for (std::size_t i = begin; i < end; i++)
+		{
+			keys[i] = this->bucket(x[i], y[i]);
+			order[i] = static_cast<std::uint32_t>(i);
+		}
+	});
+
+	// Sort the particles by bucket a digit at a time, enough digits for the last bucket
+	// Stable, so each bucket stays in index order on any number of threads
+	for (unsigned shift = 0; shift < 32 && ((buckets - 1) >> shift) != 0; shift += digitBits)
+		this->radixPass(n, shift, pool, chunk);
+
+	// A bucket starts at the first particle of a bucket at or after it, so
+	// each particle fills in the buckets between the one before it and its own
+	keys = this->bucketOf.data();
+
+	parallel_for(pool, n, chunk, [&](const std::size_t& begin, const std::size_t& end) {
+		for (std::size_t k = begin; k < end; k++)
+		{
+			const std::uint32_t first = k == 0 ? 0 : keys[k - 1] + 1;
+
+			for (std::uint32_t b = first; b <= keys[k]; b++)
+				this->bucketStart[b] = static_cast<std::uint32_t>(k);
+		}
+	});
+
+	const std::size_t last = n == 0 ? 0 : keys[n - 1] + 1;
+
+	std::fill(this->bucketStart.begin() + last, this->bucketStart.end(),
+		static_cast<std::uint32_t>(n));
+
+	return *this;
+}
+SpatialGrid& SpatialGrid::radixPass(const std::size_t& n, const unsigned& shift,
+	ThreadPool* pool, const std::size_t& chunk) {
+	TRACE_ZONE("SpatialGrid::radixPass");
+
+	const std::size_t chunks = (n + chunk - 1) / chunk;
+	const std::uint32_t mask = static_cast<std::uint32_t>(digits - 1);
+
+	this->chunkCounts.assign(chunks * digits, 0);
+
+	const std::uint32_t* keys = this->bucketOf.data();
+	const std::uint32_t* order = this->particles.data();
+	std::uint32_t* keysOut = this->keysOut.data();
+	std::uint32_t* orderOut = this->particlesOut.data();
+	std::uint32_t* chunkCounts = this->chunkCounts.data();
+
+	// Count the digits of each chunk
+	parallel_for(pool, n, chunk, [&](const std::size_t& first, const std::size_t& last) {
+		std::uint32_t* counts = chunkCounts + first / chunk * digits;
+
+		for (std::size_t i = first; i < last; i++)
+			counts[(keys[i] >> shift) & mask]++;
+	});
+
+	// Where each chunk writes each digit, every chunk's 0s, then every chunk's 1s...
+	std::uint32_t offset = 0;
+
+	for (std::size_t d = 0; d < digits; d++)
+		for (std::size_t c = 0; c < chunks; c++)
+		{
+			std::uint32_t& count = chunkCounts[c * digits + d];
+			const std::uint32_t seen = count;
+
+			count = offset;
+			offset += seen;
+		}
+
+	// Scatter each chunk in order so equal digits keep their order
+	parallel_for(pool, n, chunk, [&](const std::size_t& first, const std::size_t& last) {
+		std::uint32_t* cursor = chunkCounts + first / chunk * digits;
+
+		for (std::size_t i = first; i < last; i++)
+		{
+			const std::uint32_t to = cursor[(keys[i] >> shift) & mask]++;
+
+			keysOut[to] = keys[i];
+			orderOut[to] = order[i];
+		}
+	});
+
+	this->bucketOf.swap(this->keysOut);
+	this->particles.swap(this->particlesOut);
+
+	return *this;
+}
+SpatialGrid& SpatialGrid::collide(ParticleStore& s, const CollisionParams& params,
+	const float& cell, ThreadPool* pool, const std::size_t& chunk) {
+	const std::size_t n = s.size();
+
+	if (n == 0)
+		return *this;
+
+	this->build(s.posX.data(), s.posY.data(), n, cell, pool, chunk);
+
+	for (auto array : { &this->sortedX, &this->sortedY, &this->sortedVX, &this->sortedVY,
+			&this->sortedR, &this->dvX, &this->dvY, &this->dpX, &this->dpY })
+		array->resize(n);
+
+	const std::uint32_t* order = this->particles.data();
+
+	// Copy the particles in bucket order, neighbours then sit a few cache lines apart
+	parallel_for(pool, n, chunk, [&](const std::size_t& begin, const std::size_t& end) {
+		for (std::size_t k = begin; k < end; k++)
+		{
+			const std::uint32_t i = order[k];
+
+			this->sortedX[k] = s.posX[i];
+			this->sortedY[k] = s.posY[i];
+			this->sortedVX[k] = s.velX[i];
+			this->sortedVY[k] = s.velY[i];
+			this->sortedR[k] = s.radius[i];
+		}
+	});
+
+	const float* posX = this->sortedX.data();
+	const float* posY = this->sortedY.data();
+	const float* velX = this->sortedVX.data();
+	const float* velY = this->sortedVY.data();
+	const float* radius = this->sortedR.data();
+
+	// Every particle adds up what its neighbours do to it, reading only
+	// the state from before the collisions
+	parallel_for(pool, n, chunk, [&](const std::size_t& begin, const std::size_t& end) {
+		TRACE_ZONE("narrowphase chunk");
+
+		for (std::size_t k = begin; k < end; k++)
+		{
+			const float xk = posX[k];
+			const float yk = posY[k];
+			const float rk = radius[k];
+			const float mk = rk * rk;
+
+			float dvx = 0.0f, dvy = 0.0f, dpx = 0.0f, dpy = 0.0f;
+
+			// In a crowd, like particles that just left the emitter, test every
+			// stride-th neighbour, starting at a different one for each particle
+			const std::uint32_t stride = (this->count(xk, yk) + maxPairs - 1) / maxPairs;
+
+			this->query(xk, yk, [&](const std::uint32_t& j) {
+				if (j == k)
+					return;
+
+				float nx = xk - posX[j];
+				float ny = yk - posY[j];
+				const float reach = rk + radius[j];
+				float d2 = nx * nx + ny * ny;
+
+				// Not touching
+				if (d2 >= reach * reach)
+					return;
+
+				// Exactly on top of each other, like particles that just left the
+				// emitter, push apart sideways in opposite directions
+				if (d2 == 0.0f)
+				{
+					nx = k < j ? -1e-3f : 1e-3f;
+					d2 = 1e-6f;
+				}
+
+				const float d = std::sqrt(d2);
+				const float invD = 1.0f / d;
+				const float ux = nx * invD;
+				const float uy = ny * invD;
+
+				// Heavier neighbours push harder, mass goes with area
+				const float mj = radius[j] * radius[j];
+				const float share = mj / (mk + mj);
+
+				// Push apart along the normal
+				const float overlap = reach - d;
+				dpx += ux * overlap * share * params.separation;
+				dpy += uy * overlap * share * params.separation;
+
+				// Only bounce when moving towards each other
+				const float vn = (velX[k] - velX[j]) * ux + (velY[k] - velY[j]) * uy;
+
+				if (vn < 0.0f)
+				{
+					const float impulse = -(1.0f + params.restitution) * vn * share;
+					dvx += ux * impulse;
+					dvy += uy * impulse;
+				}
+			}, stride, static_cast<std::uint32_t>(k % stride));
+
+			this->dvX[k] = dvx;
+			this->dvY[k] = dvy;
+			this->dpX[k] = dpx;
+			this->dpY[k] = dpy;
+		}
+	});
+
+	// Apply the changes, prev moves with pos so the next update starts from the pushed position
+	parallel_for(pool, n, chunk, [&](const std::size_t& begin, const std::size_t& end) {
+		for (std::size_t k = begin; k < end; k++)
+		{
+			const std::uint32_t i = order[k];
+
+			s.velX[i] += this->dvX[k];
+			s.velY[i] += this->dvY[k];
+			s.posX[i] += this->dpX[k];
+			s.posY[i] += this->dpY[k];
+			s.prevX[i] += this->dpX[k];
+			s.prevY[i] += this->dpY[k];
+		}
+	});
+
+	return *this;
+}
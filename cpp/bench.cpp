@@ -0,0 +1,641 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../h/EmitterSystem.h"
+#include "../h/ForcePipeline.h"
+#include "../h/ParticleKernels.h"
+#include "../h/Particles.h"
+#include "../h/ThreadPool.h"
+
+/**
+ * Count every heap allocation made by the process so the benchmark
+ * can report allocations per tick of each simulation step
+ */
+static std::atomic< std::size_t > allocation_count{0};
+
+void* operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc{};
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    std::size_t a = static_cast<std::size_t>(align);
+    std::size_t rounded = (size + a - 1) / a * a;
+
+    if (void* p = std::aligned_alloc(a, rounded ? rounded : a))
+        return p;
+
+    throw std::bad_alloc{};
+}
+
+// Kept out of line so the compiler does not pair an inlined free()
+// with the operator new it knows about and warn about a mismatch
+static void __attribute__((noinline)) release(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p) noexcept { release(p); }
+void operator delete(void* p, std::size_t) noexcept { release(p); }
+void operator delete(void* p, std::align_val_t) noexcept { release(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { release(p); }
+
+using Clock = std::chrono::steady_clock;
+using String = std::string;
+
+struct Result
+{
+    String op;
+    std::size_t particles;
+    double ns_per_particle;
+    double particles_per_second;
+    double allocs_per_tick;
+};
+
+struct Case
+{
+    String op;
+    std::function< void(Particles&) > run;
+
+    // Runs once before timing when set
+    std::function< void(Particles&) > setup;
+};
+
+/**
+ * Time one step of the simulation
+ *   Runs the step enough times to cover ~10M particle updates
+ *   and keeps the median so one slow run does not skew the result
+ */
+Result time_case(const Case& c, Particles& ps)
+{
+    if (c.setup)
+        c.setup(ps);
+
+    const std::size_t n = std::max< std::size_t >(1, ps.store.size());
+    const std::size_t reps = std::max< std::size_t >(5, 10000000 / n);
+
+    std::vector< double > seconds;
+    seconds.reserve(reps);
+
+    std::size_t allocs = 0;
+
+    for (std::size_t r = 0; r < reps; r++)
+    {
+        std::size_t before = allocation_count.load(std::memory_order_relaxed);
+        auto start = Clock::now();
+
+        c.run(ps);
+
+        auto stop = Clock::now();
+        allocs += allocation_count.load(std::memory_order_relaxed) - before;
+
+        seconds.push_back(std::chrono::duration<double>(stop - start).count());
+    }
+
+    std::nth_element(seconds.begin(), seconds.begin() + reps / 2, seconds.end());
+    const double median = seconds[reps / 2];
+
+    return Result{
+        c.op,
+        n,
+        median * 1e9 / n,
+        n / median,
+        static_cast<double>(allocs) / reps
+    };
+}
+
+std::vector< Case > cases(const float& dt)
+{
+    return {
+        { "init", [](Particles& ps) { ps.init(); } },
+        { "resetParticle", [](Particles& ps) {
+            for (std::size_t i = 0; i < ps.store.size(); i++)
+                ps.resetParticle(i);
+        } },
+        { "handleEdge", [](Particles& ps) { ps.handleEdge(); } },
+        { "updatePosition", [dt](Particles& ps) { ps.updatePosition(dt); } },
+        { "interpolate", [dt](Particles& ps) { ps.interpolate(dt, 0.5f); } },
+        { "interpolateInstances", [dt](Particles& ps) {
+            static std::vector< ParticleInstance > out;
+            out.resize(ps.store.size());
+            ps.interpolate(dt, 0.5f, out.data());
+        } },
+        // Particles spread over a square that grows with their count so
+        // each one has a few neighbours at every size
+        { "collisions", [](Particles& ps) { ps.collisions(); },
+            [](Particles& ps) {
+                std::mt19937 rng(7);
+                const float side = std::sqrt(static_cast<float>(ps.store.size())) * 20.0f;
+                std::uniform_real_distribution< float > at(0.0f, side);
+                std::uniform_real_distribution< float > vel(-100.0f, 100.0f);
+
+                for (std::size_t i = 0; i < ps.store.size(); i++)
+                {
+                    ps.store.posX[i] = ps.store.prevX[i] = at(rng);
+                    ps.store.posY[i] = ps.store.prevY[i] = at(rng);
+                    ps.store.velX[i] = vel(rng);
+                    ps.store.velY[i] = vel(rng);
+                }
+
+                ps.collide = true;
+                ps.collisions();
+            } },
+        // The whole store sorted along a Z-order curve, then the same
+        // collisions with neighbours next to each other in memory
+        // Sorted every time after the first, like a store kept in order
+        { "mortonSort", [](Particles& ps) {
+            ps.morton.sort(ps.store, 0, ps.store.size(), ps.pool, ps.chunkSize);
+        } },
+        { "collisionsMorton", [](Particles& ps) { ps.collisions(); } },
+        // Every particle on the emitter, as they are when emitted together
+        // Put back before each run since collisions() spreads them
+        { "collisionsClustered", [](Particles& ps) {
+            for (std::size_t i = 0; i < ps.store.size(); i++)
+            {
+                ps.store.posX[i] = ps.store.prevX[i] = ps.pos.x;
+                ps.store.posY[i] = ps.store.prevY[i] = ps.pos.y;
+            }
+
+            ps.collisions();
+        } },
+        // Five forces in one pass over the store, then the same forces
+        // in a pass each. Every pass is a whole step that also moves the
+        // particles, so forcesSeparate integrates five times a tick and only
+        // the cost of the two compares, not the motion
+        { "forcesFused", [dt](Particles& ps) {
+            const ForcePipeline< Gravity, Drag, Wind, Attractor, Vortex > forces;
+            forces(ps.store, 0, ps.store.size(), dt);
+        } },
+        { "forcesSeparate", [dt](Particles& ps) {
+            ForcePipeline< Gravity >{}(ps.store, 0, ps.store.size(), dt);
+            ForcePipeline< Drag >{}(ps.store, 0, ps.store.size(), dt);
+            ForcePipeline< Wind >{}(ps.store, 0, ps.store.size(), dt);
+            ForcePipeline< Attractor >{}(ps.store, 0, ps.store.size(), dt);
+            ForcePipeline< Vortex >{}(ps.store, 0, ps.store.size(), dt);
+        } },
+        // Particles dying and being emitted every tick
+        // Last since it turns the emitter into a pool
+        { "lifecycle", [dt](Particles& ps) { ps.updatePosition(dt); },
+            [dt](Particles& ps) {
+                // Each particle lives 8 to 16 ticks and the pool stays about full
+                ps.minLifetime = 8 * dt;
+                ps.maxLifetime = 16 * dt;
+                ps.emissionRate = ps.numParticles / (8 * dt);
+                ps.init();
+
+                for (int t = 0; t < 32; t++)
+                    ps.updatePosition(dt);
+            } }
+    };
+}
+
+/**
+ * Run every kernel of k and of the scalar kernels on the same random
+ * particles and count the values that differ by more than a tolerance
+ */
+int check_kernels(const ParticleKernels& k)
+{
+    // An odd count so the scalar remainder of each kernel runs too
+    const std::size_t n = 4099;
+    const float dt = 1.0f / 30.0f;
+    const float tolerance = 1e-5f;
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution< float > posX(-20.0f, 820.0f);
+    std::uniform_real_distribution< float > posY(-5.0f, 40.0f);
+    std::uniform_real_distribution< float > vel(-120.0f, 120.0f);
+    std::uniform_real_distribution< float > radius(2.5f, 12.5f);
+
+    ParticleStore a;
+    a.resize(n);
+
+    for (std::size_t i = 0; i < n; i++)
+    {
+        a.posX[i] = a.prevX[i] = posX(rng);
+        a.posY[i] = a.prevY[i] = posY(rng);
+        a.velX[i] = vel(rng);
+        a.velY[i] = vel(rng);
+        a.speedX[i] = vel(rng);
+        a.speedY[i] = vel(rng) * 4.0f;
+        a.radius[i] = radius(rng);
+        a.emitter[i] = rng() % 7;
+    }
+
+    const float emitterG[7] = { 0.0f, 25.0f, 10.0f, -5.0f, 2.5f, 30.0f, 1.0f };
+
+    ParticleStore b = a;
+    std::vector< std::uint8_t > resetA(n), resetB(n);
+    std::vector< ParticleInstance > instancesA(n), instancesB(n);
+    EdgeParams edge;
+
+    auto run = [&](const ParticleKernels& kk, ParticleStore& s,
+            std::vector< std::uint8_t >& reset, std::vector< ParticleInstance >& instances) {
+        kk.movement(s.velX.data(), s.velY.data(), s.speedX.data(), s.speedY.data(), n, dt);
+        kk.gravity(s.speedY.data(), n, 750.0f * dt);
+        kk.step(s.posX.data(), s.posY.data(), s.prevX.data(), s.prevY.data(),
+            s.velX.data(), s.velY.data(), s.speedX.data(), s.speedY.data(), n, dt, 750.0f * dt);
+        kk.bounce(s.posX.data(), s.posY.data(), s.velX.data(), s.velY.data(),
+            s.radius.data(), reset.data(), n, edge);
+        kk.emitterGravity(s.speedY.data(), s.emitter.data(), emitterG, n);
+        kk.integrate(s.prevX.data(), s.prevY.data(), s.posX.data(), s.posY.data(),
+            s.velX.data(), s.velY.data(), n, dt * 0.5f);
+        kk.instances(instances.data(), s.prevX.data(), s.prevY.data(),
+            s.velX.data(), s.velY.data(), s.radius.data(), n, dt * 0.25f, 0x11223344);
+    };
+
+    run(ParticleKernels::scalar(), a, resetA, instancesA);
+    run(k, b, resetB, instancesB);
+
+    auto differs = [&](const ParticleStore::FloatArray& x, const ParticleStore::FloatArray& y) {
+        std::size_t count = 0;
+
+        for (std::size_t i = 0; i < n; i++)
+            if (std::abs(x[i] - y[i]) > tolerance * std::max(1.0f, std::abs(x[i])))
+                count++;
+
+        return count;
+    };
+
+    std::size_t errors =
+        differs(a.posX, b.posX) + differs(a.posY, b.posY) +
+        differs(a.prevX, b.prevX) + differs(a.prevY, b.prevY) +
+        differs(a.velX, b.velX) + differs(a.velY, b.velY) +
+        differs(a.speedY, b.speedY);
+
+    std::size_t resets = 0;
+
+    for (std::size_t i = 0; i < n; i++)
+    {
+        errors += resetA[i] != resetB[i];
+        resets += resetA[i];
+
+        const ParticleInstance& ia = instancesA[i];
+        const ParticleInstance& ib = instancesB[i];
+
+        errors += std::abs(ia.x - ib.x) > tolerance * std::max(1.0f, std::abs(ia.x));
+        errors += std::abs(ia.y - ib.y) > tolerance * std::max(1.0f, std::abs(ia.y));
+        errors += ia.radius != ib.radius || ia.color != ib.color;
+    }
+
+    std::cout << std::left << std::setw(8) << k.name <<
+        (errors == 0 ? "matches scalar" : "DIFFERS from scalar") <<
+        " (" << errors << " mismatches, " << resets << " resets)\n";
+
+    return errors == 0 ? 0 : 1;
+}
+
+/**
+ * Time the threaded steps on 1 to max_threads threads
+ */
+void thread_scaling(const std::size_t& n, const std::size_t& max_threads, const float& dt)
+{
+    std::vector< std::size_t > counts;
+
+    for (std::size_t t = 1; t < max_threads; t *= 2)
+        counts.push_back(t);
+
+    counts.push_back(max_threads);
+
+    std::cout << "\nThread scaling at " << n << " particles\n" <<
+        std::left << std::setw(22) << "Op" <<
+        std::setw(12) << "Threads" <<
+        std::setw(14) << "ns/particle" <<
+        std::setw(16) << "particles/s" <<
+        "speedup\n";
+
+    std::map< String, double > single;
+
+    for (const auto& t : counts)
+    {
+        ThreadPool pool(t);
+
+        Particles ps;
+        ps.numParticles = n;
+        ps.seed = 1;
+        ps.pool = &pool;
+        ps.init();
+
+        for (const auto& c : cases(dt))
+        {
+            if (c.op == "init" || c.op == "resetParticle")
+                continue;
+
+            Result r = time_case(c, ps);
+
+            if (t == 1)
+                single[r.op] = r.ns_per_particle;
+
+            std::cout << std::left << std::setw(22) << r.op <<
+                std::setw(12) << t <<
+                std::setw(14) << std::setprecision(4) << r.ns_per_particle <<
+                std::setw(16) << std::setprecision(4) << r.particles_per_second <<
+                single[r.op] / r.ns_per_particle << "x\n";
+        }
+    }
+}
+
+/**
+ * Time emitters sharing one EmitterSystem against one Particles per emitter
+ *   Every particle lives 8 to 16 ticks and the pools stay about full
+ */
+void emitter_batching(const std::size_t& n, const std::size_t& emitters, const float& dt)
+{
+    const std::size_t perEmitter = std::max< std::size_t >(1, n / emitters);
+    const float rate = perEmitter / (8 * dt);
+    const int reps = 50;
+
+    EmitterSystem system;
+    system.numParticles = perEmitter * emitters;
+    system.seed = 1;
+
+    for (std::size_t e = 0; e < emitters; e++)
+    {
+        Emitter em;
+        em.pos.x = 800.0f * (e + 0.5f) / emitters;
+        em.emissionRate = rate;
+        em.minLifetime = 8 * dt;
+        em.maxLifetime = 16 * dt;
+        em.gravity = 500.0f + e % 5 * 100.0f;
+        system.add(em);
+    }
+
+    system.init();
+
+    std::vector< Particles > separate(emitters);
+
+    for (std::size_t e = 0; e < emitters; e++)
+    {
+        Particles& ps = separate[e];
+        ps.numParticles = perEmitter;
+        ps.seed = 1 + e;
+        ps.pos.x = 800.0f * (e + 0.5f) / emitters;
+        ps.emissionRate = rate;
+        ps.minLifetime = 8 * dt;
+        ps.maxLifetime = 16 * dt;
+        ps.gravity = 500.0f + e % 5 * 100.0f;
+        ps.init();
+    }
+
+    auto median_ns = [&](const std::function< std::size_t() >& tick) {
+        std::vector< double > ns;
+
+        for (int t = 0; t < 32; t++)
+            tick();
+
+        for (int r = 0; r < reps; r++)
+        {
+            auto start = Clock::now();
+            std::size_t live = tick();
+            auto stop = Clock::now();
+
+            ns.push_back(std::chrono::duration<double, std::nano>(stop - start).count() /
+                std::max< std::size_t >(1, live));
+        }
+
+        std::nth_element(ns.begin(), ns.begin() + reps / 2, ns.end());
+        return ns[reps / 2];
+    };
+
+    const double batched = median_ns([&]() {
+        std::size_t live = system.store.size();
+        system.updatePosition(dt);
+        return live;
+    });
+
+    const double loop = median_ns([&]() {
+        std::size_t live = 0;
+
+        for (auto& ps : separate)
+        {
+            live += ps.store.size();
+            ps.updatePosition(dt);
+        }
+
+        return live;
+    });
+
+    std::cout << "\n" << emitters << " emitters, " << perEmitter * emitters << " particles\n" <<
+        std::left << std::setw(22) << "EmitterSystem" << std::setprecision(4) << batched << " ns/particle\n" <<
+        std::setw(22) << "Particles each" << std::setprecision(4) << loop << " ns/particle\n" <<
+        std::setw(22) << "speedup" << loop / batched << "x\n";
+}
+
+std::vector< std::size_t > parse_sizes(const String& list)
+{
+    std::vector< std::size_t > sizes;
+    std::stringstream ss(list);
+    String item;
+
+    while (std::getline(ss, item, ','))
+        sizes.push_back(static_cast<std::size_t>(std::atof(item.c_str())));
+
+    return sizes;
+}
+
+/**
+ * Baseline files hold one "op particles ns_per_particle" line per result
+ * Lines starting with # are comments
+ */
+std::map< std::pair< String, std::size_t >, double > read_baseline(const String& file_name)
+{
+    std::map< std::pair< String, std::size_t >, double > baseline;
+    std::ifstream file(file_name);
+    String line;
+
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::stringstream ss(line);
+        String op;
+        std::size_t particles;
+        double ns;
+
+        if (ss >> op >> particles >> ns)
+            baseline[{op, particles}] = ns;
+    }
+
+    return baseline;
+}
+
+void write_baseline(const String& file_name, const std::vector< Result >& results)
+{
+    std::ofstream file(file_name);
+
+    file << "# op particles ns_per_particle\n";
+
+    for (const auto& r : results)
+        file << r.op << " " << r.particles << " " << r.ns_per_particle << "\n";
+}
+
+void usage(const char* name)
+{
+    std::cout << "Usage: " << name << " [options]\n"
+        "\t--sizes 1e3,1e4,...      particle counts to run\n"
+        "\t--baseline FILE          fail when a result regresses past FILE\n"
+        "\t--tolerance 0.25         allowed slowdown against the baseline\n"
+        "\t--write-baseline FILE    store the results as a new baseline\n"
+        "\t--check-kernels          compare the SIMD kernels against scalar\n"
+        "\t--threads N              report scaling from 1 to N threads, 0 for all cores\n"
+        "\t--scaling-size 1e6       particles used for the scaling report\n"
+        "\t--emitters 256           emitters in the batching report\n";
+}
+
+/**
+ * Time each simulation step at several particle counts
+ */
+int main (int argc, char* argv[])
+{
+    std::vector< std::size_t > sizes = parse_sizes("1e3,1e4,1e5,1e6,1e7");
+    String baseline_file;
+    String write_file;
+    double tolerance = 0.25;
+    std::size_t max_threads = std::thread::hardware_concurrency();
+    std::size_t scaling_size = 1000000;
+    std::size_t emitters = 256;
+
+    for (int a = 1; a < argc; a++)
+    {
+        String arg = argv[a];
+
+        if (arg == "--sizes" && a + 1 < argc)
+            sizes = parse_sizes(argv[++a]);
+        else if (arg == "--baseline" && a + 1 < argc)
+            baseline_file = argv[++a];
+        else if (arg == "--tolerance" && a + 1 < argc)
+            tolerance = std::atof(argv[++a]);
+        else if (arg == "--write-baseline" && a + 1 < argc)
+            write_file = argv[++a];
+        else if (arg == "--threads" && a + 1 < argc)
+            max_threads = std::atol(argv[++a]);
+        else if (arg == "--scaling-size" && a + 1 < argc)
+            scaling_size = static_cast<std::size_t>(std::atof(argv[++a]));
+        else if (arg == "--emitters" && a + 1 < argc)
+            emitters = std::min< std::size_t >(std::max< long >(1, std::atol(argv[++a])), EmitterSystem::maxEmitters);
+        else if (arg == "--check-kernels")
+        {
+            int failed = 0;
+
+            for (auto k : { ParticleKernels::sse2(), ParticleKernels::avx2(), ParticleKernels::avx512() })
+                if (k)
+                    failed += check_kernels(*k);
+
+            return failed == 0 ? 0 : 1;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    const float dt = 1.0f / 30.0f;
+    std::vector< Result > results;
+
+    std::cout << "Kernels " << ParticleKernels::get().name << "\n";
+
+    std::cout << std::left << std::setw(22) << "Op" <<
+        std::setw(12) << "Particles" <<
+        std::setw(14) << "ns/particle" <<
+        std::setw(16) << "particles/s" <<
+        "allocs/tick\n";
+
+    for (const auto& n : sizes)
+    {
+        Particles ps;
+        ps.numParticles = n;
+        ps.init();
+
+        for (const auto& c : cases(dt))
+        {
+            Result r = time_case(c, ps);
+            results.push_back(r);
+
+            std::cout << std::left << std::setw(22) << r.op <<
+                std::setw(12) << r.particles <<
+                std::setw(14) << std::setprecision(4) << r.ns_per_particle <<
+                std::setw(16) << std::setprecision(4) << r.particles_per_second <<
+                r.allocs_per_tick << "\n";
+        }
+    }
+
+    thread_scaling(scaling_size, std::max< std::size_t >(1, max_threads), dt);
+    emitter_batching(scaling_size, emitters, dt);
+
+    if (!write_file.empty())
+        write_baseline(write_file, results);
+
+    if (baseline_file.empty())
+        return 0;
+
+    auto baseline = read_baseline(baseline_file);
+
+    if (baseline.empty())
+    {
+        std::cout << "Could not read baseline " << baseline_file << "\n";
+        return 1;
+    }
+
+    int regressions = 0;
+
+    for (const auto& r : results)
+    {
+        auto found = baseline.find({r.op, r.particles});
+
+        if (found == baseline.end())
+            continue;
+
+        if (r.ns_per_particle > found->second * (1.0 + tolerance))
+        {
+            std::cout << "REGRESSION " << r.op << " at " << r.particles <<
+                " particles: " << r.ns_per_particle << " ns/particle, baseline " <<
+                found->second << "\n";
+            regressions++;
+        }
+    }
+
+    if (regressions == 0)
+        std::cout << "No regressions against " << baseline_file << "\n";
+
+    return regressions == 0 ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../h/FrameStats.h"
+#include "../h/Particles.h"
+#include "../h/Recording.h"
+
+/**
+ * The percentiles of how long one tick took
+ *   A run can be fast on average and still miss frames
+ * @param ticks
+ */
+void printTickTimes(const Histogram& ticks)
+{
+    HistogramWindow w;
+    w.update(ticks);
+
+    std::cout << "Tick p50 (us)\t" << w.percentile(50) / 1e3 << "\n" <<
+        "Tick p99 (us)\t" << w.percentile(99) / 1e3 << "\n" <<
+        "Tick max (us)\t" << w.max() / 1e3 << "\n";
+}
+
+/**
+ * Step what the replay set up through every tick of the recording
+ *   As fast as the CPU allows, so a recording of minutes replays in seconds
+ *   Returns 1 when a recorded checksum does not match
+ */
+template <typename Sim>
+int play(Replay& replay, Sim& sim, ThreadPool& pool, const bool& printChecksums)
+{
+    sim.pool = &pool;
+    sim.init();
+
+    Replay::Record record;
+    long ticks = 0;
+    long inputs = 0;
+    long checked = 0;
+    long diverged = -1;
+    double simulated = 0;
+    double updates = 0;
+    std::chrono::steady_clock::duration busy{};
+    Histogram tickTimes;
+
+    if (printChecksums)
+        std::cout << "Tick\tChecksum\n";
+
+    while (replay.next(record))
+    {
+        switch (record.kind)
+        {
+            case RecordKind::Ticks:
+            {
+                for (std::uint32_t t = 0; t < record.count; t++)
+                {
+                    updates += sim.store.size();
+
+                    // Only the simulation is timed, not the checksums
+                    auto start = std::chrono::steady_clock::now();
+                    sim.updatePosition(record.dt);
+                    sim.collisions();
+                    auto stop = std::chrono::steady_clock::now();
+
+                    busy += stop - start;
+                    tickTimes.record(std::chrono::duration_cast< std::chrono::nanoseconds >(stop - start).count());
+
+                    ticks++;
+                    simulated += record.dt;
+
+                    if (printChecksums)
+                        std::cout << ticks << "\t" << std::hex << sim.store.checksum() << std::dec << "\n";
+                }
+                break;
+            }
+            case RecordKind::Input:
+                inputs++;
+                break;
+            case RecordKind::Checksum:
+            {
+                checked++;
+
+                if (diverged < 0 && sim.store.checksum() != record.checksum)
+                    diverged = ticks;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    const double seconds = std::chrono::duration<double>(busy).count();
+
+    std::cout << "Kernels\t\t" << sim.kernels->name << "\n" <<
+        "Live\t\t" << sim.store.size() << "\n" <<
+        "Threads\t\t" << pool.size() << "\n" <<
+        "Ticks\t\t" << ticks << "\n" <<
+        "Inputs\t\t" << inputs << "\n" <<
+        "Simulated (s)\t" << simulated << "\n" <<
+        "Seconds\t\t" << seconds << "\n" <<
+        "Ticks/s\t\t" << ticks / seconds << "\n" <<
+        "Realtime\t" << simulated / seconds << "x\n" <<
+        "ns/particle\t" << seconds * 1e9 / updates << "\n";
+
+    printTickTimes(tickTimes);
+
+    std::cout << "Checksum\t" << std::hex << sim.store.checksum() << std::dec << "\n";
+
+    if (checked == 0)
+        return 0;
+
+    if (diverged >= 0)
+    {
+        std::cout << "Diverged\tafter tick " << diverged << "\n";
+        return 1;
+    }
+
+    std::cout << "Matched\t\t" << checked << " checksums\n";
+
+    return 0;
+}
+
+/**
+ * Replay a recording made with --record here or in Particles
+ * @param path
+ * @param threads
+ * @param printChecksums
+ */
+int replay(const std::string& path, const long& threads, const bool& printChecksums)
+{
+    Replay replay;
+
+    if (!replay.open(path))
+        return 1;
+
+    // The setup comes first
+    Replay::Record record;
+
+    if (!replay.next(record) ||
+            (record.kind != RecordKind::Particles && record.kind != RecordKind::Emitters))
+    {
+        std::cout << path << " does not start with a setup\n";
+        return 1;
+    }
+
+    // Other kernels round differently so the checksums will not match
+    const ParticleKernels& kernels = ParticleKernels::get(replay.kernels);
+
+    if (replay.kernels != kernels.name)
+        std::cout << "Recorded with " << replay.kernels << " kernels, replaying with " <<
+            kernels.name << "\n";
+
+    ThreadPool pool(threads);
+
+    std::cout << "Recording\t" << path << "\n" <<
+        "Version\t\t" << replay.version << "\n";
+
+    if (record.kind == RecordKind::Emitters)
+        return play(replay, replay.system, pool, printChecksums);
+
+    return play(replay, replay.particles, pool, printChecksums);
+}
+
+/**
+ * Step the simulation without a window or an OpenGL context
+ *
+ * Usage: particles_headless [particles] [ticks] [updates_per_second] [threads] [seed]
+ *                           [emission_rate] [lifetime] [--record file] [--checksums]
+ *                           [--reorder slices]
+ *        particles_headless --replay file [threads] [--checksums]
+ *   threads 0 uses every core
+ *   emission_rate 0 keeps every particle alive, otherwise particles is the pool size
+ *   and each one lives up to lifetime seconds
+ *   --record writes the run to file, with --checksums the state after every tick too
+ *   --replay steps a recording as fast as it can and checks its checksums,
+ *   with --checksums it prints the checksum after every tick
+ *   --trace file writes the zones of a PARTICLES_TRACE build for chrome://tracing
+ *   --reorder sorts one of slices slices of the particles by Morton code every tick
+ */
+int main (int argc, char* argv[])
+{
+    long numParticles = 100000;
+    long ticks = 300;
+    long updatesPerSecond = 30;
+    long threads = 1;
+    long seed = 1;
+    float emissionRate = 0.0f;
+    float lifetime = 0.0f;
+
+    std::string recordPath;
+    std::string replayPath;
+    std::string tracePath;
+    bool checksums = false;
+    long reorderSlices = 0;
+
+    TRACE_THREAD("main");
+
+    // Options anywhere, the rest in order
+    std::vector< char* > args;
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (std::strcmp(argv[a], "--record") == 0 && a + 1 < argc)
+            recordPath = argv[++a];
+        else if (std::strcmp(argv[a], "--replay") == 0 && a + 1 < argc)
+            replayPath = argv[++a];
+        else if (std::strcmp(argv[a], "--checksums") == 0)
+            checksums = true;
+        else if (std::strcmp(argv[a], "--trace") == 0 && a + 1 < argc)
+            tracePath = argv[++a];
+        else if (std::strcmp(argv[a], "--reorder") == 0 && a + 1 < argc)
+            reorderSlices = std::atol(argv[++a]);
+        else
+            args.push_back(argv[a]);
+    }
+
+    if (!replayPath.empty())
+    {
+        const int result = replay(replayPath, args.size() > 0 ? std::atol(args[0]) : 1, checksums);
+
+        if (!tracePath.empty())
+            Trace::write(tracePath);
+
+        return result;
+    }
+
+    if (args.size() > 0)
+        numParticles = std::atol(args[0]);
+    if (args.size() > 1)
+        ticks = std::atol(args[1]);
+    if (args.size() > 2)
+        updatesPerSecond = std::atol(args[2]);
+    if (args.size() > 3)
+        threads = std::atol(args[3]);
+    if (args.size() > 4)
+        seed = std::atol(args[4]);
+    if (args.size() > 5)
+        emissionRate = std::atof(args[5]);
+    if (args.size() > 6)
+        lifetime = std::atof(args[6]);
+
+    if (numParticles <= 0 || ticks <= 0 || updatesPerSecond <= 0 || threads < 0 ||
+            emissionRate < 0.0f || lifetime < 0.0f || reorderSlices < 0)
+    {
+        std::cout << "Usage: " << argv[0] <<
+            " [particles] [ticks] [updates_per_second] [threads] [seed]"
+            " [emission_rate] [lifetime] [--record file] [--checksums] [--reorder slices]\n"
+            "       " << argv[0] << " --replay file [threads] [--checksums]\n"
+            "       --trace file.json with a PARTICLES_TRACE build\n";
+        return 1;
+    }
+
+    const float dt = 1.0f / updatesPerSecond;
+
+    ThreadPool pool(threads);
+
+    Particles particles;
+    particles.numParticles = numParticles;
+    particles.seed = seed;
+    particles.pool = &pool;
+    particles.emissionRate = emissionRate;
+    particles.minLifetime = lifetime / 2;
+    particles.maxLifetime = lifetime;
+    particles.morton.slices = reorderSlices;
+    particles.init();
+
+    Recorder recorder;
+    recorder.checksums = checksums;
+
+    if (!recordPath.empty() && !recorder.open(recordPath))
+        return 1;
+
+    recorder.setup(particles);
+
+    // Only live particles are updated
+    double updates = 0;
+    Histogram tickTimes;
+
+    auto start = std::chrono::steady_clock::now();
+    auto tickStart = start;
+
+    for (long t = 0; t < ticks; t++)
+    {
+        updates += particles.store.size();
+        recorder.tick(dt);
+        particles.updatePosition(dt);
+        particles.collisions();
+        recorder.checksum(particles.store);
+
+        auto tickStop = std::chrono::steady_clock::now();
+        tickTimes.record(std::chrono::duration_cast< std::chrono::nanoseconds >(tickStop - tickStart).count());
+        tickStart = tickStop;
+    }
+
+    auto stop = std::chrono::steady_clock::now();
+
+    recorder.close();
+
+    const double seconds = std::chrono::duration<double>(stop - start).count();
+
+    std::cout << "Particles\t" << numParticles << "\n" <<
+        "Live\t\t" << particles.store.size() << "\n" <<
+        "Threads\t\t" << pool.size() << "\n" <<
+        "Ticks\t\t" << ticks << "\n" <<
+        "Seconds\t\t" << seconds << "\n" <<
+        "Ticks/s\t\t" << ticks / seconds << "\n" <<
+        "Particles/s\t" << updates / seconds << "\n" <<
+        "ns/particle\t" << seconds * 1e9 / updates << "\n" <<
+        "Memory (MB)\t" << particles.store.bytes() / (1024.0 * 1024.0) << "\n";
+
+    printTickTimes(tickTimes);
+
+    std::cout << "Checksum\t" << std::hex << particles.store.checksum() << "\n";
+
+    if (!tracePath.empty())
+        Trace::write(tracePath);
+
+    return 0;
+}
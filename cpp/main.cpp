@@ -26,7 +26,21 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "../h/ComputeParticles.h"
+#include "../h/EmitterSystem.h"
+#include "../h/ForcePipeline.h"
+#include "../h/FrameCapture.h"
 #include "../h/Particles.h"
+#include "../h/ParticlesRenderer.h"
+#include "../h/Recording.h"
+#include "../h/Snapshot.h"
+#include "../h/TripleBuffer.h"
 
 
 class myGameLoop :
@@ -35,13 +49,184 @@ class myGameLoop :
     using GameLoop::GameLoop;
 
 private:
+	ThreadPool pool;
 	Particles particles;
+	EmitterSystem system;
+	ParticlesRenderer renderer;
+
+	// The GPU backend and what it downloads when comparing
+	ComputeParticles compute;
+	ParticleStore computeStore;
+	std::vector< std::uint8_t > computeReset;
 
+	// The ticks the simulation thread hands the main thread when pipelined
+	TripleBuffer< Snapshot > snapshots;
+	std::uint64_t ticks = 0;
+	float lastDelta = 0.0f;
 
 public:
+	// Simulate this many emitters in an EmitterSystem instead of one Particles
+	int numEmitters = 0;
+
+	// Simulate with compute shaders instead of on the CPU
+	bool gpu = false;
+
+	// Step both backends from the same state and compare them for this many ticks
+	int compareTicks = 0;
+	int mismatches = 0;
+
+	// Record the run so particles_headless --replay can step it again
+	Recorder recorder;
+
+	// Draw the particles with the triangle fan mesh instead of sprites
+	bool meshes = false;
+
+	// Upload every particle, even those off the screen
+	bool noCull = false;
+
+	// Sort the particles along a Z-order curve, one of this many slices a tick
+	std::size_t reorderSlices = 0;
+
+	// Move the particles with gravity, drag, wind and a vortex, see ForcePipeline
+	bool forces = false;
+
+	// Draw offscreen and write every frame here, see FrameCapture
+	std::string capturePath;
+	FrameCapture capture;
+
     virtual void init()
     {
+    	// Sized like the window the projection was made for
+    	if (!capturePath.empty() && !capture.init(capturePath, 800, 600, static_cast<int>(frame_rate())))
+    		is_running = false;
+
+    	renderer.sprites = !meshes;
+    	renderer.cull = !noCull;
+
+    	// A capture steps and draws on the main thread, see offline_loop()
+    	if (offline_frames > 0 && pipelined)
+    	{
+    		std::cout << "A capture can not be pipelined\n";
+    		pipelined = false;
+    	}
+
+    	// Replays step with the kernels
+    	if (forces && recorder.isOpen())
+    	{
+    		std::cout << "Forces are not recorded\n";
+    		recorder.close();
+    	}
+
+    	if (numEmitters > 0)
+    	{
+    		initEmitters();
+    		recorder.setup(system);
+    		return;
+    	}
+
+    	particles.pool = &pool;
+    	particles.collide = true;
     	particles.init();
+    	renderer.init(particles);
+
+    	if ((gpu || compareTicks > 0) && !ComputeParticles::supported())
+    	{
+    		std::cout << "Compute shaders are not supported, simulating on the CPU\n";
+    		gpu = false;
+    		compareTicks = 0;
+    	}
+
+    	if (gpu || compareTicks > 0)
+    		compute.init(particles);
+
+    	// The GPU backend updates on the GL context of the main thread
+    	if ((gpu || compareTicks > 0) && pipelined)
+    	{
+    		std::cout << "Only the CPU backend can be pipelined\n";
+    		pipelined = false;
+    	}
+
+    	// The GPU keeps the particles in the order they were copied
+    	if ((gpu || compareTicks > 0) && reorderSlices > 0)
+    	{
+    		std::cout << "Only the CPU backend can be reordered\n";
+    		reorderSlices = 0;
+    	}
+
+    	particles.morton.slices = reorderSlices;
+
+    	if ((gpu || compareTicks > 0) && forces)
+    	{
+    		std::cout << "Only the CPU backend has forces\n";
+    		forces = false;
+    	}
+
+    	if (forces)
+    		particles.forces = demoForces();
+
+    	// Replays run on the CPU
+    	if ((gpu || compareTicks > 0) && recorder.isOpen())
+    	{
+    		std::cout << "Only the CPU backend can be recorded\n";
+    		recorder.close();
+    	}
+
+    	recorder.setup(particles);
+    }
+
+    /**
+     * The usual gravity with a light wind to the right, drag and a vortex in the middle of the window
+     */
+    static ForceStep demoForces()
+    {
+        return ForcePipeline< Gravity, Drag, Wind, Vortex >(
+            Gravity{ 750.0f },
+            Drag{ 0.3f },
+            Wind{ 80.0f, 0.0f, 0.2f },
+            Vortex{ 400.0f, 300.0f, 60000.0f, 10000.0f });
+    }
+
+    /**
+     * Rows of emitters across the window, alternating between solid and additive
+     */
+    void initEmitters()
+    {
+        const int columns = std::min(numEmitters, 32);
+        const int rows = (numEmitters + columns - 1) / columns;
+
+        for (int e = 0; e < numEmitters; e++)
+        {
+            Emitter em;
+            em.pos.x = 800.0f * (e % columns + 0.5f) / columns;
+            em.pos.y = 50.0f + 500.0f * (e / columns) / rows;
+            em.emissionRate = 200.0f;
+            em.maxSpeedX = 400;
+            em.material = e % 2;
+
+            // A color from the emitter index, alpha in the high byte
+            em.color = 0xFF000000u |
+                (0x40 + e * 37 % 0xC0) << 16 |
+                (0x40 + e * 91 % 0xC0) << 8 |
+                (0x40 + e * 53 % 0xC0);
+
+            if (system.add(em) == EmitterSystem::noEmitter)
+            {
+                std::cout << "Only " << EmitterSystem::maxEmitters << " emitters fit in a system\n";
+                numEmitters = e;
+                break;
+            }
+        }
+
+        system.numParticles = static_cast<std::size_t>(numEmitters) * 200 * 4;
+        system.pool = &pool;
+        system.collide = true;
+        system.morton.slices = reorderSlices;
+
+        if (forces)
+            system.forces = demoForces();
+
+        system.init();
+        renderer.init(system);
     }
 
     virtual void console_output()
@@ -51,6 +236,9 @@ public:
 
     virtual void inputs(SDL_Event& events)
     {
+        if (events.type == SDL_KEYDOWN)
+            recorder.input(events.type, events.key.keysym.sym);
+
         if (events.type == SDL_KEYDOWN &&
                 events.key.keysym.sym == SDLK_SPACE)
             toggle_pause();
@@ -58,37 +246,247 @@ public:
 
     virtual void update_positions(const float& delta)
     {
+        recorder.tick(delta);
+        lastDelta = delta;
+
+        if (compareTicks > 0)
+        {
+            compare(delta);
+            return;
+        }
+
+        if (numEmitters > 0)
+            system.updatePosition(delta);
+        else if (gpu)
+            compute.updatePosition(delta);
+        else
+            particles.updatePosition(delta);
+    }
+
+    /**
+     * Step both backends from the CPU state and count the particles they disagree on
+     *   Respawns draw different random numbers on the GPU so only their flags are compared
+     * @param delta
+     */
+    void compare(const float& delta)
+    {
+        compute.upload(particles.store);
+        compute.updatePosition(delta);
         particles.updatePosition(delta);
+        compute.download(computeStore, computeReset);
+
+        const ParticleStore& cpu = particles.store;
+        const ParticleStore& other = computeStore;
+        const float tolerance = 1e-3f;
+
+        auto near = [tolerance](const float& a, const float& b)
+        {
+            return std::fabs(a - b) <= tolerance * std::fmax(1.0f, std::fabs(a));
+        };
+
+        int bad = 0;
+
+        for (std::size_t i = 0; i < cpu.size(); i++)
+        {
+            if ((particles.reset[i] != 0) != (computeReset[i] != 0))
+            {
+                bad++;
+                continue;
+            }
+
+            if (particles.reset[i])
+                continue;
+
+            if (!near(cpu.posX[i], other.posX[i]) || !near(cpu.posY[i], other.posY[i]) ||
+                !near(cpu.velX[i], other.velX[i]) || !near(cpu.velY[i], other.velY[i]) ||
+                !near(cpu.speedX[i], other.speedX[i]) || !near(cpu.speedY[i], other.speedY[i]))
+                bad++;
+        }
+
+        if (bad > 0)
+            std::cout << "Tick " << compareTicks << ": " << bad << " particles differ\n";
+
+        mismatches += bad;
+
+        if (--compareTicks == 0)
+        {
+            std::cout << (mismatches == 0 ? "CPU and GPU match\n" : "CPU and GPU differ\n");
+            is_running = false;
+        }
     }
 
     virtual void collisions()
-    {}
+    {
+        // The GPU backend has no collisions yet
+        if (numEmitters > 0)
+            system.collisions();
+        else if (!gpu)
+            particles.collisions();
+
+        recorder.checksum(numEmitters > 0 ? system.store : particles.store);
+    }
+
+    /**
+     * Copy what the main thread draws of the tick that just ran
+     */
+    virtual void publish()
+    {
+        const ParticleStore& store = numEmitters > 0 ? system.store : particles.store;
+
+        snapshots.write_buffer().capture(store, ++ticks, lastDelta);
+        snapshots.publish();
+    }
 
     virtual void interpolate(const float& delta, const float& interpolation)
     {
-        particles.interpolate(delta, interpolation);
+        if (pipelined)
+        {
+            interpolateSnapshot();
+            return;
+        }
+
+        if (numEmitters > 0)
+            renderer.interpolate(system, delta, interpolation);
+        else if (gpu)
+            compute.interpolate(delta, interpolation);
+        else
+            renderer.interpolate(particles, delta, interpolation);
+    }
+
+    /**
+     * Interpolate the newest tick the simulation thread published
+     *   From when it was published, the next tick is already running
+     */
+    void interpolateSnapshot()
+    {
+        snapshots.acquire();
+        const Snapshot& snap = snapshots.read_buffer();
+
+        // Nothing was simulated yet
+        if (snap.tick == 0)
+            return;
+
+        const float ip = snap.interpolation(Snapshot::Clock::now());
+
+        if (numEmitters > 0)
+            renderer.interpolate(system, snap, ip);
+        else
+            renderer.interpolate(particles, snap, ip);
     }
 
     virtual void draw(){
+        if (capture.isOpen())
+            capture.bind();
+
         glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        particles.draw();
+        if (numEmitters > 0)
+            renderer.draw(system);
+        else if (gpu)
+            renderer.draw(compute);
+        else if (pipelined)
+            renderer.drawWritten();
+        else
+            renderer.draw(particles);
 
-        SDL_GL_SwapWindow(win);
+        stats.count_instances(renderer.drawCount, renderer.culled);
+    }
+
+    virtual void swap()
+    {
+        // The window is hidden while capturing
+        if (capture.isOpen())
+            capture.read();
+        else
+            SDL_GL_SwapWindow(win);
     }
 };
 
 int main (int argc, char* argv[])
 {
-    SDLWindow win("My Game", 800, 600, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+    // Capturing draws offscreen, the window is only there for its GL context
+    bool hidden = false;
+
+    for (int a = 1; a < argc; a++)
+        hidden = hidden || std::strcmp(argv[a], "--capture") == 0;
+
+    SDLWindow win("My Game", 800, 600, SDL_WINDOW_OPENGL |
+        (hidden ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN));
 
     glewExperimental = GL_TRUE;
     glewInit();
 
     myGameLoop myGame(30, myGameLoop::INTERPOLATIONS::FOUR);
 
+    // Particles --backend cpu|gpu --compare [ticks] --emitters N --record file [--checksums]
+    //           --stats file.csv|file.json [seconds] --trace file.json --pipeline
+    //           --fps N (0 for uncapped) --spin --capture file.y4m|frames/%05d.ppm [frames]
+    //           --mesh --no-cull --reorder [slices] --forces
+    std::string tracePath;
+    TRACE_THREAD("main");
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (std::strcmp(argv[a], "--emitters") == 0 && a + 1 < argc)
+            myGame.numEmitters = std::atoi(argv[++a]);
+        else if (std::strcmp(argv[a], "--backend") == 0 && a + 1 < argc)
+            myGame.gpu = std::strcmp(argv[++a], "gpu") == 0;
+        else if (std::strcmp(argv[a], "--compare") == 0)
+            myGame.compareTicks = (a + 1 < argc && argv[a + 1][0] != '-') ? std::atoi(argv[++a]) : 300;
+        else if (std::strcmp(argv[a], "--record") == 0 && a + 1 < argc)
+        {
+            if (!myGame.recorder.open(argv[++a]))
+                return 1;
+        }
+        else if (std::strcmp(argv[a], "--checksums") == 0)
+            myGame.recorder.checksums = true;
+        else if (std::strcmp(argv[a], "--stats") == 0 && a + 1 < argc)
+        {
+            const char* path = argv[++a];
+            const double interval = (a + 1 < argc && argv[a + 1][0] != '-') ? std::atof(argv[++a]) : 1.0;
+
+            if (!myGame.stats.export_to(path, interval > 0.0 ? interval : 1.0))
+                return 1;
+        }
+        else if (std::strcmp(argv[a], "--trace") == 0 && a + 1 < argc)
+            tracePath = argv[++a];
+        else if (std::strcmp(argv[a], "--pipeline") == 0)
+            myGame.pipelined = true;
+        else if (std::strcmp(argv[a], "--fps") == 0 && a + 1 < argc)
+            myGame.set_render_rate(std::max(0, std::atoi(argv[++a])));
+        else if (std::strcmp(argv[a], "--spin") == 0)
+            myGame.busy_wait = true;
+        else if (std::strcmp(argv[a], "--mesh") == 0)
+            myGame.meshes = true;
+        else if (std::strcmp(argv[a], "--no-cull") == 0)
+            myGame.noCull = true;
+        else if (std::strcmp(argv[a], "--reorder") == 0)
+            myGame.reorderSlices = (a + 1 < argc && argv[a + 1][0] != '-') ? std::max(1, std::atoi(argv[++a])) : 4;
+        else if (std::strcmp(argv[a], "--forces") == 0)
+            myGame.forces = true;
+        else if (std::strcmp(argv[a], "--capture") == 0 && a + 1 < argc)
+        {
+            myGame.capturePath = argv[++a];
+            myGame.offline_frames = (a + 1 < argc && argv[a + 1][0] != '-') ? std::atoi(argv[++a]) : 600;
+        }
+    }
+
+    // The compute shaders simulate a single Particles emitter
+    if (myGame.numEmitters > 0 && (myGame.gpu || myGame.compareTicks > 0))
+    {
+        std::cout << "--emitters runs on the CPU only, it can not be used with --backend gpu or --compare\n";
+        return 1;
+    }
+
     myGame.start(win);
+    myGame.capture.finish();
+
+    // Every frame of the run, the tail is what stutters
+    myGame.stats.report(std::cout);
+
+    if (!tracePath.empty())
+        Trace::write(tracePath);
 
-    return 0;
+    return myGame.mismatches == 0 ? 0 : 1;
 }   
@@ -1,9 +1,24 @@
 #version 430 core
 
 in vec3 vColor;
-out vec3 outColor;
+
+// Where in the circle this is, 1 at its edge
+in vec2 vLocal;
+
+out vec4 outColor;
 
 void main()
 {
-    outColor = vColor;
+    // Signed distance to the edge, negative inside, in pixels
+    float d = length(vLocal) - 1.0;
+    d /= max(fwidth(d), 1e-6);
+
+    // How much of the pixel the circle covers
+    float coverage = clamp(0.5 - d, 0.0, 1.0);
+
+    if (coverage <= 0.0)
+        discard;
+
+    // Premultiplied so additive and solid materials both blend the edge
+    outColor = vec4(vColor * coverage, coverage);
 }
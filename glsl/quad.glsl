@@ -0,0 +1,28 @@
+#version 430 core
+
+// One quad per particle, the corners come from gl_VertexID so there is no mesh
+// The circle is cut out of it in fragment.glsl
+
+// Per instance, one of each per particle
+in vec2 offset;
+in float radius;
+in vec4 instanceColor;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 proj;
+
+out vec3 vColor;
+out vec2 vLocal;
+
+void main()
+{
+    // A triangle strip of (-1, -1) (1, -1) (-1, 1) (1, 1)
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.0 - 1.0;
+
+    // A pixel larger than the circle so its anti-aliased edge fits
+    vLocal = corner * (1.0 + 1.0 / max(radius, 1.0));
+
+    vColor = instanceColor.rgb;
+    gl_Position = proj * view * model * vec4(vLocal * radius + offset, 0.0, 1.0);
+}
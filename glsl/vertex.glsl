@@ -1,17 +1,26 @@
 #version 430 core
 
+// The unit circle mesh
 in vec3 position;
 in vec3 color;
-// in GLfloat now;
+
+// Per instance, one of each per particle
+in vec2 offset;
+in float radius;
+in vec4 instanceColor;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 proj;
 
 out vec3 vColor;
+out vec2 vLocal;
 
 void main()
 {
-    vColor = color;
-    gl_Position = proj * view * model * vec4(position.x, position.y, position.z, 1.0);
+    vColor = color * instanceColor.rgb;
+
+    // The mesh is the circle, nothing for fragment.glsl to cut out
+    vLocal = vec2(0.0);
+    gl_Position = proj * view * model * vec4(position.xy * radius + offset, position.z, 1.0);
 }
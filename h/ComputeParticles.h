@@ -0,0 +1,115 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __COMPUTE_PARTICLES__
+#define __COMPUTE_PARTICLES__
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GLProgram.h"
+#include "Particles.h"
+
+// Runs the simulation of Particles on the GPU with compute shaders
+//
+// The particle state lives in shader storage buffers laid out like
+// ParticleStore, one buffer per array. glsl/update.comp does a whole
+// updatePosition() in one dispatch and glsl/interpolate.comp writes
+// ParticleInstances into a buffer the renderer draws from directly,
+// so particles never come back to the CPU.
+//
+// Respawns hash the particle index, tick and seed on the GPU, so they
+// are not the same random speeds the CPU would pick.
+//
+// Only a fixed set of particles respawning at the edges is simulated:
+// emission rates, lifetimes, collisions, forces, Morton order and
+// EmitterSystem are not supported on this path.
+class ComputeParticles{
+public:
+	using MapInt = std::unordered_map< std::string, GLint >;
+
+	// The settings of Particles the shaders read
+	struct Settings {
+		Vec2 pos;
+		float gravity = 750.0f;
+		int maxSpeedX = 1000;
+		int minSpeedY = 300;
+		int maxSpeedY = 450;
+		EdgeParams edge;
+		std::uint32_t color = 0xFFFFFFFF;
+		std::uint32_t seed = 0;
+	};
+
+	// One buffer per ParticleStore array, then the reset flags and the instances
+	enum BUFFERS {
+		POS_X, POS_Y, PREV_X, PREV_Y, VEL_X, VEL_Y, SPEED_X, SPEED_Y, RADIUS,
+		RESET, INSTANCES, COUNT
+	};
+
+	GLuint buffers[BUFFERS::COUNT] = {};
+
+	// Copied from Particles in init()
+	Settings config;
+
+	std::size_t numParticles = 0;
+	std::uint32_t tick = 0;
+
+	virtual ~ComputeParticles();
+
+	/**
+	 * Does this context have compute shaders
+	 */
+	static bool supported();
+
+	ComputeParticles& init(const Particles& ps);
+
+	/**********************************************
+	*
+	*				OpenGL
+	*
+	***********************************************/
+	ComputeParticles& compileShaders();
+	ComputeParticles& upload(const ParticleStore& store);
+	ComputeParticles& download(ParticleStore& store, std::vector< std::uint8_t >& reset);
+	GLuint instanceBuffer() const;
+
+	/**********************************************
+	*
+	*				Logic
+	*
+	***********************************************/
+	ComputeParticles& updatePosition(const float& dt = 1);
+	ComputeParticles& interpolate(const float& dt = 1, const float& ip = 1);
+
+private:
+	GLProgram update;
+	GLProgram interpolation;
+
+	MapInt uniform;
+
+	GLint location(GLProgram& prg, const std::string& name);
+	ComputeParticles& bindBuffers();
+	ComputeParticles& dispatch();
+};
+
+#endif
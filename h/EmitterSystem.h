@@ -0,0 +1,198 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __EMITTER_SYSTEM__
+#define __EMITTER_SYSTEM__
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "ForcePipeline.h"
+#include "MortonOrder.h"
+#include "ParticleInstance.h"
+#include "ParticleKernels.h"
+#include "ParticleStore.h"
+#include "Particles.h"
+#include "Random.h"
+#include "SpatialGrid.h"
+#include "ThreadPool.h"
+
+// Everything that makes one emitter different from another
+// Same meaning as the members of Particles with the same names
+struct Emitter {
+	Vec2 pos = {400.0f, 50.0f};
+	std::uint32_t color = 0xFFFFFFFF;
+
+	int maxRadius = 1000;
+	int minRadius = 250;
+
+	float gravity = 750.0f;
+
+	int maxSpeedX = 1000;
+	int minSpeedY = 300;
+	int maxSpeedY = 450;
+
+	// Particles per second
+	float emissionRate = 100.0f;
+
+	// A maxLifetime of 0 lives until it slows down or leaves the screen
+	float minLifetime = 2.0f;
+	float maxLifetime = 4.0f;
+
+	// Particles of the same material are drawn together
+	// See ParticlesRenderer::materials
+	std::uint16_t material = 0;
+
+	// Seed of this emitter's random number stream
+	// 0 follows EmitterSystem::seed and the emitter's index
+	std::uint32_t seed = 0;
+};
+
+// Many emitters sharing one pool of particles
+//
+// Every particle remembers the index of its emitter in store.emitter.
+// The particles of all emitters are simulated together in one pass over
+// the store and the kernels look the per emitter values up by that index,
+// so a thousand emitters cost the same as one emitter with as many particles.
+class EmitterSystem{
+public:
+	// The particles of every emitter, live ones packed at the front
+	ParticleStore store;
+
+	// Set to 1 for each particle that dies this update
+	std::vector< std::uint8_t > reset;
+
+	const ParticleKernels* kernels = &ParticleKernels::get();
+
+	EdgeParams edge;
+
+	ThreadPool* pool = nullptr;
+
+	// Particles per chunk of work, read by init()
+	std::size_t chunkSize = 8192;
+
+	// Seed of the random number streams, 0 seeds from the clock
+	// and init() keeps the one it picked here
+	// Every emitter draws from its own stream so adding one does not
+	// change the particles of the others
+	std::uint32_t seed = 0;
+
+	// The most particles alive at once across all emitters
+	std::size_t numParticles = 100000;
+
+	// Let particles of every emitter bounce off each other in collisions()
+	bool collide = false;
+	CollisionParams collision;
+	SpatialGrid grid;
+
+	// Sorts a slice of the particles along a Z-order curve after every
+	// updatePosition() when its slices is set, see MortonOrder
+	MortonOrder morton;
+
+	// Moves the particles in updatePosition() instead of the kernels when set,
+	// the gravity of the emitters is then left out, see ForcePipeline
+	ForceStep forces;
+
+	EmitterSystem& init();
+
+	// Particles store their emitter's index in 16 bits
+	static constexpr std::size_t maxEmitters = std::size_t(std::numeric_limits< std::uint16_t >::max()) + 1;
+
+	// What add() returns when there are maxEmitters already
+	static constexpr std::size_t noEmitter = std::numeric_limits< std::size_t >::max();
+
+	/**
+	 * Add an emitter
+	 *   Returns its index, particles remember it in store.emitter, or
+	 *   noEmitter without adding it when the system is full
+	 * @param e
+	 */
+	std::size_t add(const Emitter& e);
+
+	/**
+	 * The emitters, in the order add() returned their indices
+	 */
+	const std::vector< Emitter >& emitters() const;
+
+	/**
+	 * Replace emitter e
+	 *   The only way to change an emitter, so the per emitter tables
+	 *   follow it. A new seed restarts its random number stream
+	 * @param e
+	 * @param em
+	 */
+	EmitterSystem& set(const std::size_t& e, const Emitter& em);
+
+	/**
+	 * Number of materials used by the emitters
+	 */
+	std::size_t materials() const;
+
+	/**
+	 * Start of each material's instances written by interpolate()
+	 *   Material m is [ranges()[m], ranges()[m + 1])
+	 */
+	const std::vector< std::size_t >& ranges() const;
+
+	EmitterSystem& burst(const std::size_t& e, const std::size_t& count);
+
+	/**********************************************
+	*
+	*				Logic
+	*
+	***********************************************/
+	EmitterSystem& updatePosition(const float& dt = 1);
+	EmitterSystem& collisions();
+	EmitterSystem& interpolate(const float& dt, const float& ip, ParticleInstance* out);
+	EmitterSystem& interpolate(const ParticleStore& from, const float& dt, const float& ip,
+		ParticleInstance* out, ThreadPool* threads);
+
+private:
+	// The seed init() settled on
+	std::uint32_t startSeed = 0;
+
+	// Changed through add() and set() only, they keep the tables below in step
+	std::vector< Emitter > list;
+
+	// Per emitter tables, indexed by store.emitter
+	std::vector< Random > rng;
+	std::vector< float > gravityStep;
+	std::vector< std::uint16_t > materialOf;
+	std::vector< float > emitted;
+
+	// The chunkSize init() split the store by
+	std::size_t chunk = 8192;
+
+	// Particles left in each chunk after an update, see ParticleStore::closeGaps()
+	std::vector< std::size_t > chunkLive;
+
+	// Instances of each material in each chunk, then where the chunk writes them
+	std::vector< std::size_t > chunkCounts;
+	std::vector< std::size_t > materialStart;
+
+	template <typename Fn>
+	void forEachChunk(const Fn& fn);
+
+	EmitterSystem& seedEmitter(const std::size_t& e);
+	EmitterSystem& emit(const float& dt);
+};
+
+#endif
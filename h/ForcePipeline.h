@@ -0,0 +1,256 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __FORCE_PIPELINE__
+#define __FORCE_PIPELINE__
+
+#include <cstddef>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "ParticleStore.h"
+
+// Forces have to be inlined before the loop is vectorized
+#define FORCE_INLINE __attribute__((always_inline)) inline
+
+/**
+ * One particle as the forces see it
+ *   Position and velocity are read only. A force adds to accelX and
+ *   accelY, in pixels per second squared, or changes speed, the
+ *   particle's own acceleration that carries over to the next update
+ */
+struct ForceParticle
+{
+    float x;
+    float y;
+    float velX;
+    float velY;
+    float speedX;
+    float speedY;
+    float accelX = 0.0f;
+    float accelY = 0.0f;
+};
+
+/**
+ * Pulls speed down by g every second, like Particles::addGravity()
+ */
+struct Gravity
+{
+    float g = 750.0f;
+
+    FORCE_INLINE void operator()(ForceParticle& p, const float& dt) const
+    {
+        p.speedY -= g * dt;
+    }
+};
+
+/**
+ * Slows particles down in proportion to their velocity
+ */
+struct Drag
+{
+    // Share of the velocity lost per second
+    float k = 0.5f;
+
+    FORCE_INLINE void operator()(ForceParticle& p, const float&) const
+    {
+        p.accelX -= k * p.velX;
+        p.accelY -= k * p.velY;
+    }
+};
+
+/**
+ * Drags particles towards the velocity of the air
+ */
+struct Wind
+{
+    float x = 100.0f;
+    float y = 0.0f;
+    float strength = 0.5f;
+
+    FORCE_INLINE void operator()(ForceParticle& p, const float&) const
+    {
+        p.accelX += strength * (x - p.velX);
+        p.accelY += strength * (y - p.velY);
+    }
+};
+
+/**
+ * Pulls particles towards a point, falling off with the distance
+ *   Like gravity in a plane, so no square root. softening keeps
+ *   particles at the point from shooting off
+ */
+struct Attractor
+{
+    float x = 400.0f;
+    float y = 300.0f;
+    float strength = 50000.0f;
+    float softening = 2500.0f;
+
+    FORCE_INLINE void operator()(ForceParticle& p, const float&) const
+    {
+        const float dx = x - p.x;
+        const float dy = y - p.y;
+        const float s = strength / (dx * dx + dy * dy + softening);
+
+        p.accelX += s * dx;
+        p.accelY += s * dy;
+    }
+};
+
+/**
+ * Swirls particles counterclockwise around a point, falling off with the distance
+ */
+struct Vortex
+{
+    float x = 400.0f;
+    float y = 300.0f;
+    float strength = 60000.0f;
+    float softening = 10000.0f;
+
+    FORCE_INLINE void operator()(ForceParticle& p, const float&) const
+    {
+        const float dx = p.x - x;
+        const float dy = p.y - y;
+        const float s = strength / (dx * dx + dy * dy + softening);
+
+        p.accelX -= s * dy;
+        p.accelY += s * dx;
+    }
+};
+
+/**
+ * Steps particles [begin, end) of a store by dt, see ForcePipeline
+ */
+using ForceStep = std::function< void(ParticleStore&, const std::size_t&, const std::size_t&, const float&) >;
+
+/**
+ * Forces put together at compile time into one pass over the particles
+ *
+ * Each force is a small type called with every particle, see Gravity.
+ * Its call operator should be FORCE_INLINE.
+ * The calls are expanded into the body of a single loop, so any number
+ * of forces costs one read and write of the arrays and nothing is
+ * called through a pointer per particle. A different mix of forces is
+ * a different type:
+ *
+ *   particles.forces = ForcePipeline< Gravity, Drag, Wind >{ {}, { 0.2f }, {} };
+ *
+ * A step is the step() kernel with the forces in it
+ *   vel += (speed + accel) * dt, speed is then what the forces left,
+ *   pos = prev + vel * dt
+ * so ForcePipeline< Gravity > moves particles exactly like the scalar
+ * kernels with the same gravity.
+ */
+template <typename... Forces>
+class ForcePipeline
+{
+public:
+    std::tuple< Forces... > forces;
+
+    ForcePipeline() = default;
+
+    template <std::size_t N = sizeof...(Forces), typename = std::enable_if_t< N != 0 > >
+    explicit ForcePipeline(const Forces&... f) : forces(f...) {}
+
+    /**
+     * The force of type F, to change it between updates
+     *   A ForceStep holds its own copy of the pipeline, reach that one with
+     *   particles.forces.target< ForcePipeline< Gravity, Drag > >()->get< Drag >()
+     */
+    template <typename F>
+    F& get()
+    {
+        return std::get< F >(forces);
+    }
+
+    /**
+     * Step particles [begin, end) of s by dt
+     * @param s
+     * @param begin
+     * @param end
+     * @param dt
+     */
+    void operator()(ParticleStore& s, const std::size_t& begin, const std::size_t& end, const float& dt) const
+    {
+        this->step(s.posX.data() + begin, s.posY.data() + begin,
+            s.prevX.data() + begin, s.prevY.data() + begin,
+            s.velX.data() + begin, s.velY.data() + begin,
+            s.speedX.data() + begin, s.speedY.data() + begin,
+            end - begin, dt);
+    }
+
+private:
+    // Particles a block, a trip count the compiler can vectorize at -O2
+    static constexpr std::size_t block = 8;
+
+    // The arrays of a store never overlap, restrict lets the loop be vectorized
+    // Inlined into the caller it loses the restrict
+    __attribute__((noinline)) void step(float* __restrict posX, float* __restrict posY,
+        const float* __restrict prevX, const float* __restrict prevY,
+        float* __restrict velX, float* __restrict velY,
+        float* __restrict speedX, float* __restrict speedY,
+        std::size_t n, float dt) const
+    {
+        // A copy the stores can not change, so its values stay in registers
+        const std::tuple< Forces... > f = this->forces;
+        std::size_t i = 0;
+
+        for (; i + block <= n; i += block)
+            for (std::size_t j = i; j < i + block; j++)
+                particle(f, posX, posY, prevX, prevY, velX, velY, speedX, speedY, j, dt);
+
+        for (; i < n; i++)
+            particle(f, posX, posY, prevX, prevY, velX, velY, speedX, speedY, i, dt);
+    }
+
+    static FORCE_INLINE void particle(const std::tuple< Forces... >& f,
+        float* __restrict posX, float* __restrict posY,
+        const float* __restrict prevX, const float* __restrict prevY,
+        float* __restrict velX, float* __restrict velY,
+        float* __restrict speedX, float* __restrict speedY,
+        std::size_t i, float dt)
+    {
+        ForceParticle p{ prevX[i], prevY[i], velX[i], velY[i], speedX[i], speedY[i] };
+
+        apply(f, p, dt, std::index_sequence_for< Forces... >{});
+
+        // The speed from before the forces, as in step()
+        const float vx = velX[i] + (speedX[i] + p.accelX) * dt;
+        const float vy = velY[i] + (speedY[i] + p.accelY) * dt;
+
+        velX[i] = vx;
+        velY[i] = vy;
+        speedX[i] = p.speedX;
+        speedY[i] = p.speedY;
+
+        posX[i] = prevX[i] + vx * dt;
+        posY[i] = prevY[i] + vy * dt;
+    }
+
+    template <std::size_t... I>
+    static FORCE_INLINE void apply(const std::tuple< Forces... >& f, ForceParticle& p, const float& dt, std::index_sequence< I... >)
+    {
+        (std::get< I >(f)(p, dt), ...);
+    }
+};
+
+#endif
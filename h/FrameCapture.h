@@ -0,0 +1,129 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __FRAME_CAPTURE__
+#define __FRAME_CAPTURE__
+
+#include <GL/glew.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Renders into an offscreen framebuffer and writes every frame to disk
+//
+//   capture.init("frames/%05d.ppm", 800, 600, 120);
+//   capture.bind();    // before drawing a frame
+//   capture.read();    // after drawing it
+//   capture.finish();  // once the last frame was drawn
+//
+// read() only queues a glReadPixels into the next of a ring of pixel
+// buffer objects, the GPU copies the frame while it carries on. The
+// frame is mapped ring frames later when the copy is long done, and a
+// worker thread converts and writes it, so the draw loop never waits on
+// the GPU or the disk unless the disk falls behind by queued frames.
+//
+// A path ending in .y4m is one raw YUV 4:4:4 stream any video tool
+// reads, anything else is a printf pattern for a sequence of PPMs.
+class FrameCapture{
+public:
+	static constexpr int ring = 3;
+
+	// Frames converted or waiting for the worker before read() waits for it
+	static constexpr std::size_t queued = 8;
+
+	enum class Format {
+		PPM, Y4M
+	};
+
+	GLsizei width = 0;
+	GLsizei height = 0;
+
+	std::uint64_t framesRead = 0;
+	std::uint64_t framesWritten = 0;
+
+	virtual ~FrameCapture();
+
+	/**
+	 * Make the framebuffer and the ring and start the worker
+	 *   Returns false when the path or the framebuffer is no good
+	 * @param path
+	 * @param w
+	 * @param h
+	 * @param framesPerSecond of the Y4M stream
+	 */
+	bool init(const std::string& path, const GLsizei& w, const GLsizei& h, const int& framesPerSecond);
+	bool isOpen() const;
+
+	/**********************************************
+	*
+	*				OpenGL
+	*
+	***********************************************/
+	FrameCapture& bind();
+	FrameCapture& read();
+
+	// Write the frames still in the ring and stop the worker
+	FrameCapture& finish();
+
+private:
+	Format format = Format::PPM;
+	std::string path;
+
+	GLuint fbo = 0;
+	GLuint color = 0;
+	GLuint pbos[ring] = {};
+	GLsync fences[ring] = {};
+
+	// The next slot of the ring read() copies into
+	int slot = 0;
+
+	// Frames the worker writes and buffers it is done with
+	std::thread worker;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque< std::vector< std::uint8_t > > frames;
+	std::vector< std::vector< std::uint8_t > > spare;
+	bool running = false;
+
+	// Only the worker touches these
+	std::ofstream stream;
+	std::vector< std::uint8_t > scratch;
+
+	FrameCapture& collect(const int& s);
+	FrameCapture& destroy();
+
+	/**********************************************
+	*
+	*				Worker
+	*
+	***********************************************/
+	void work();
+	bool write(const std::vector< std::uint8_t >& rgba, const std::uint64_t& frame);
+	bool writePPM(const std::vector< std::uint8_t >& rgba, const std::uint64_t& frame);
+	bool writeY4M(const std::vector< std::uint8_t >& rgba);
+};
+
+#endif
@@ -0,0 +1,498 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __FRAME_STATS__
+#define __FRAME_STATS__
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "Trace.h"
+
+/**
+ * Counts of durations in nanoseconds, log linear like an HDR histogram
+ *
+ * Each power of two is split into 32 buckets, so any duration from 1 ns
+ * to centuries lands in a bucket no more than ~3% wide and a percentile
+ * is off by at most that much. record() is one relaxed atomic add, so
+ * any thread can record while another reads, with no lock.
+ *
+ * The counts only ever grow; see HistogramWindow for the counts of the
+ * last few seconds.
+ */
+class Histogram
+{
+public:
+    static constexpr int sub_bits = 5;
+    static constexpr std::size_t sub_buckets = std::size_t(1) << sub_bits;
+    static constexpr std::size_t buckets = (64 - sub_bits + 1) * sub_buckets;
+
+    using Counts = std::array< std::uint64_t, buckets >;
+
+    Histogram()
+    {
+        for (auto& c : counts)
+            c.store(0, std::memory_order_relaxed);
+    }
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    /**
+     * Count one duration
+     * @param ns
+     */
+    void record(const std::uint64_t& ns)
+    {
+        counts[index(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Copy every count into out
+     * @param out
+     */
+    void snapshot(Counts& out) const
+    {
+        for (std::size_t b = 0; b < buckets; b++)
+            out[b] = counts[b].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * The bucket ns falls in
+     *   Below 32 each value has its own bucket, above that the top
+     *   sub_bits bits under the highest set bit pick one of 32
+     * @param ns
+     */
+    static std::size_t index(const std::uint64_t& ns)
+    {
+        if (ns < sub_buckets)
+            return static_cast<std::size_t>(ns);
+
+        const int top = 63 - __builtin_clzll(ns);
+        const int shift = top - sub_bits;
+
+        return (top - sub_bits + 1) * sub_buckets + ((ns >> shift) & (sub_buckets - 1));
+    }
+
+    /**
+     * The largest duration that lands in bucket b
+     * @param b
+     */
+    static std::uint64_t highest(const std::size_t& b)
+    {
+        if (b < sub_buckets)
+            return b;
+
+        const int shift = static_cast<int>(b / sub_buckets) - 1;
+        const std::uint64_t sub = b % sub_buckets + sub_buckets;
+
+        return ((sub + 1) << shift) - 1;
+    }
+
+private:
+    std::array< std::atomic< std::uint64_t >, buckets > counts;
+};
+
+/**
+ * The durations a Histogram counted since the last update()
+ *
+ * Every reader keeps its own window, so the console can look at the
+ * last second while a file gets the last ten without either resetting
+ * the histogram under the other.
+ */
+class HistogramWindow
+{
+public:
+    HistogramWindow()
+    {
+        last.fill(0);
+        window.fill(0);
+    }
+
+    /**
+     * Move the window up to now
+     * @param h
+     */
+    void update(const Histogram& h)
+    {
+        h.snapshot(window);
+
+        total = 0;
+
+        for (std::size_t b = 0; b < Histogram::buckets; b++)
+        {
+            const std::uint64_t now = window[b];
+            window[b] -= last[b];
+            last[b] = now;
+            total += window[b];
+        }
+    }
+
+    std::uint64_t count() const
+    {
+        return total;
+    }
+
+    /**
+     * The duration p percent of the window took at most, in nanoseconds
+     *   Rounded up to the end of its bucket so a tail is never understated
+     * @param p 0 to 100
+     */
+    std::uint64_t percentile(const double& p) const
+    {
+        if (total == 0)
+            return 0;
+
+        // The rank of the duration we want, at least the first
+        std::uint64_t rank = static_cast<std::uint64_t>(p / 100.0 * total + 0.5);
+        rank = rank < 1 ? 1 : rank > total ? total : rank;
+
+        std::uint64_t seen = 0;
+
+        for (std::size_t b = 0; b < Histogram::buckets; b++)
+        {
+            seen += window[b];
+
+            if (seen >= rank)
+                return Histogram::highest(b);
+        }
+
+        return 0;
+    }
+
+    std::uint64_t max() const
+    {
+        return percentile(100.0);
+    }
+
+private:
+    Histogram::Counts last;
+    Histogram::Counts window;
+    std::uint64_t total = 0;
+};
+
+/**
+ * Nanosecond timings of each phase of the game loop
+ *
+ * GameLoop times every phase it runs, the time between two drawn
+ * frames and how much that changed from one frame to the next, and
+ * counts the updates it ran back to back to catch up. The game counts
+ * the instances it drew and culled with count_instances().
+ *
+ * report() shows the percentiles of the last interval and export_to()
+ * appends them to a CSV or JSON file every few seconds, since a smooth
+ * average says nothing about the frames that hitch.
+ */
+class FrameStats
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum PHASES
+    {
+        EVENTS, UPDATE, COLLISIONS, PUBLISH, INTERPOLATE, DRAW, SWAP, FRAME, JITTER, COUNT
+    };
+
+    // Counted since the start, see Window
+    Histogram phases[COUNT];
+    std::atomic< std::uint64_t > updates{0};
+    std::atomic< std::uint64_t > skips{0};
+    std::atomic< std::uint64_t > drawn{0};
+    std::atomic< std::uint64_t > culled{0};
+
+    /**
+     * Percentiles of every phase since the last update()
+     */
+    struct Window
+    {
+        HistogramWindow phases[COUNT];
+        std::uint64_t updates = 0;
+        std::uint64_t skips = 0;
+        std::uint64_t drawn = 0;
+        std::uint64_t culled = 0;
+
+        void update(const FrameStats& stats)
+        {
+            for (int p = 0; p < COUNT; p++)
+                phases[p].update(stats.phases[p]);
+
+            const std::uint64_t u = stats.updates.load(std::memory_order_relaxed);
+            const std::uint64_t s = stats.skips.load(std::memory_order_relaxed);
+            const std::uint64_t d = stats.drawn.load(std::memory_order_relaxed);
+            const std::uint64_t c = stats.culled.load(std::memory_order_relaxed);
+
+            updates = u - updates_total;
+            skips = s - skips_total;
+            drawn = d - drawn_total;
+            culled = c - culled_total;
+            updates_total = u;
+            skips_total = s;
+            drawn_total = d;
+            culled_total = c;
+        }
+
+        /**
+         * Instances drawn and culled per drawn frame
+         */
+        double drawn_per_frame() const
+        {
+            return per_frame(drawn);
+        }
+
+        double culled_per_frame() const
+        {
+            return per_frame(culled);
+        }
+
+    private:
+        std::uint64_t updates_total = 0;
+        std::uint64_t skips_total = 0;
+        std::uint64_t drawn_total = 0;
+        std::uint64_t culled_total = 0;
+
+        double per_frame(const std::uint64_t& n) const
+        {
+            const std::uint64_t frames = phases[DRAW].count();
+
+            return frames > 0 ? static_cast<double>(n) / frames : 0.0;
+        }
+    };
+
+    FrameStats() {}
+
+    FrameStats(const FrameStats&) = delete;
+    FrameStats& operator=(const FrameStats&) = delete;
+
+    ~FrameStats()
+    {
+        close();
+    }
+
+    static Clock::time_point now()
+    {
+        return Clock::now();
+    }
+
+    static const char* name(const int& phase)
+    {
+        static const char* names[COUNT] = {
+            "events", "update", "collisions", "publish", "interpolate", "draw", "swap", "frame", "jitter"
+        };
+
+        return names[phase];
+    }
+
+    /**
+     * Count the time since start against phase
+     *   Returns now, the start of whatever comes next
+     * @param phase
+     * @param start
+     */
+    Clock::time_point record(const PHASES& phase, const Clock::time_point& start)
+    {
+        const Clock::time_point end = now();
+        TRACE_SPAN(name(phase), start, end);
+
+        phases[phase].record(static_cast<std::uint64_t>(
+            std::chrono::duration_cast< std::chrono::nanoseconds >(end - start).count()));
+
+        return end;
+    }
+
+    /**
+     * Count the instances one frame drew and the ones it left out
+     * @param drawn_instances
+     * @param culled_instances
+     */
+    void count_instances(const std::uint64_t& drawn_instances, const std::uint64_t& culled_instances)
+    {
+        drawn.fetch_add(drawn_instances, std::memory_order_relaxed);
+        culled.fetch_add(culled_instances, std::memory_order_relaxed);
+    }
+
+    /**
+     * Append a row of percentiles to path every interval seconds
+     *   A path ending in .json gets a JSON array, anything else CSV
+     *   Returns false when the file can not be written
+     * @param path
+     * @param interval
+     */
+    bool export_to(const std::string& path, const double& interval)
+    {
+        close();
+
+        out.open(path, std::ios::trunc);
+
+        if (!out)
+        {
+            std::cout << "Could not write the frame stats " << path << "\n";
+            return false;
+        }
+
+        json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        export_interval = std::chrono::duration_cast< Clock::duration >(
+            std::chrono::duration< double >(interval));
+        started = next_export = now();
+        next_export += export_interval;
+        rows = 0;
+
+        if (json)
+            out << "[\n";
+        else
+        {
+            out << "time_s,updates,skips,drawn_per_frame,culled_per_frame";
+
+            for (int p = 0; p < COUNT; p++)
+                out << "," << name(p) << "_count," << name(p) << "_p50_us," <<
+                    name(p) << "_p95_us," << name(p) << "_p99_us," << name(p) << "_max_us";
+
+            out << "\n";
+        }
+
+        return true;
+    }
+
+    /**
+     * Write the row for the interval when it is over
+     *   Call once a loop with the time it read
+     * @param time
+     */
+    void maybe_export(const Clock::time_point& time)
+    {
+        if (!out.is_open() || time < next_export)
+            return;
+
+        next_export += export_interval;
+
+        // Fell far behind, do not write a burst of empty rows
+        if (next_export < time)
+            next_export = time + export_interval;
+
+        exported.update(*this);
+        write_row(std::chrono::duration< double >(time - started).count());
+    }
+
+    /**
+     * Finish the export file
+     */
+    void close()
+    {
+        if (!out.is_open())
+            return;
+
+        if (json)
+            out << "\n]\n";
+
+        out.close();
+    }
+
+    /**
+     * Print the percentiles of every phase since the last report()
+     */
+    void report(std::ostream& os)
+    {
+        reported.update(*this);
+
+        os << std::left << std::setw(14) << "Phase" << std::setw(10) << "Count" <<
+            std::setw(10) << "p50 ms" << std::setw(10) << "p95 ms" <<
+            std::setw(10) << "p99 ms" << "max ms\n";
+
+        for (int p = 0; p < COUNT; p++)
+        {
+            const HistogramWindow& w = reported.phases[p];
+
+            if (w.count() == 0)
+                continue;
+
+            os << std::left << std::setw(14) << name(p) << std::setw(10) << w.count() <<
+                std::fixed << std::setprecision(3) <<
+                std::setw(10) << w.percentile(50) / 1e6 << std::setw(10) << w.percentile(95) / 1e6 <<
+                std::setw(10) << w.percentile(99) / 1e6 << w.max() / 1e6 << "\n";
+
+            os.unsetf(std::ios::fixed);
+        }
+
+        os << "Skipped draws " << reported.skips << " of " << reported.updates << " updates\n";
+        os << "Drew " << static_cast<std::uint64_t>(reported.drawn_per_frame()) << " and culled " <<
+            static_cast<std::uint64_t>(reported.culled_per_frame()) << " instances per frame\n";
+    }
+
+private:
+    Window reported;
+    Window exported;
+
+    std::ofstream out;
+    bool json = false;
+    std::size_t rows = 0;
+    Clock::time_point started;
+    Clock::time_point next_export;
+    Clock::duration export_interval{};
+
+    void write_row(const double& time)
+    {
+        if (json)
+        {
+            out << (rows > 0 ? ",\n" : "") << "  {\"time_s\": " << time <<
+                ", \"updates\": " << exported.updates << ", \"skips\": " << exported.skips <<
+                ", \"drawn_per_frame\": " << exported.drawn_per_frame() <<
+                ", \"culled_per_frame\": " << exported.culled_per_frame();
+
+            for (int p = 0; p < COUNT; p++)
+            {
+                const HistogramWindow& w = exported.phases[p];
+
+                out << ", \"" << name(p) << "\": {\"count\": " << w.count() <<
+                    ", \"p50_us\": " << w.percentile(50) / 1e3 <<
+                    ", \"p95_us\": " << w.percentile(95) / 1e3 <<
+                    ", \"p99_us\": " << w.percentile(99) / 1e3 <<
+                    ", \"max_us\": " << w.max() / 1e3 << "}";
+            }
+
+            out << "}";
+        }
+        else
+        {
+            out << time << "," << exported.updates << "," << exported.skips << "," <<
+                exported.drawn_per_frame() << "," << exported.culled_per_frame();
+
+            for (int p = 0; p < COUNT; p++)
+            {
+                const HistogramWindow& w = exported.phases[p];
+
+                out << "," << w.count() << "," << w.percentile(50) / 1e3 << "," <<
+                    w.percentile(95) / 1e3 << "," << w.percentile(99) / 1e3 << "," <<
+                    w.max() / 1e3;
+            }
+
+            out << "\n";
+        }
+
+        out.flush();
+        rows++;
+    }
+};
+
+#endif
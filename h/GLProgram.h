@@ -24,6 +24,12 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <filesystem>
+#include <unordered_map>
+
+#include "Trace.h"
 
 class GLShader
 {
@@ -144,6 +150,8 @@ private:
 
     void init()
     {
+        TRACE_ZONE("GLShader::init");
+
         try
         {
             openFile();
@@ -194,6 +202,14 @@ public:
             std::cout << "Could not initialize GLProgram\n";
     }
 
+    /**
+     * Wrap a program that is already linked
+     * @param linked
+     */
+    explicit GLProgram(const GLuint& linked)
+        : prg(linked)
+    {}
+
     GLProgram(const GLProgram& rhs)
     {
         copy(rhs);
@@ -247,6 +263,9 @@ private:
     void create_new_program()
     {
         prg = glCreateProgram();
+
+        // Let GLProgramCache read the linked binary back
+        glProgramParameteri(prg, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     }
 
     void attach_shaders()
@@ -314,6 +333,8 @@ private:
 
     int init()
     {
+        TRACE_ZONE("GLProgram::link");
+
         create_new_program();
 
         attach_shaders();
@@ -329,4 +350,236 @@ private:
     }
 };
 
+/**
+ * Compiles each shader program once and shares it
+ *
+ * Programs are keyed by their shader files and a hash of the files'
+ * contents, so editing a shader builds a new program. Linked programs
+ * are also written to disk with glGetProgramBinary and loaded back with
+ * glProgramBinary on the next start, which skips GLSL compilation
+ * entirely. Binaries only work on the driver that made them, so the
+ * driver's vendor, renderer and version strings are part of the hash.
+ */
+class GLProgramCache
+{
+    using String = std::string;
+
+public:
+    struct Source
+    {
+        GLuint type;
+        String file_name;
+    };
+
+    using vec_Source = std::vector<Source>;
+
+private:
+    using vec_GLShader = std::vector<GLShader>;
+
+    String directory;
+    std::unordered_map<String, GLProgram> programs;
+
+public:
+    /**
+     * Constructor
+     * @param dir where program binaries are kept, empty to keep them in memory only
+     */
+    explicit GLProgramCache(const String& dir = "glsl/cache")
+        : directory(dir)
+    {}
+
+    /**
+     * The cache used by every object in the process
+     */
+    static GLProgramCache& shared()
+    {
+        static GLProgramCache cache;
+
+        return cache;
+    }
+
+    /**
+     * The program built from these shader files
+     *   From memory, else from a binary on disk, else compiled and linked.
+     *   Only a miss reads the files, and a program that failed to link is
+     *   returned but neither kept nor saved, so the next call tries again
+     * @param sources
+     */
+    GLProgram get(const vec_Source& sources)
+    {
+        TRACE_ZONE("GLProgramCache::get");
+
+        const String names = names_key(sources);
+
+        auto found = programs.find(names);
+        if (found != programs.end())
+            return found->second;
+
+        const String key = make_key(sources);
+
+        GLuint prg = load_binary(key);
+
+        if (prg == 0)
+        {
+            // Build the shaders in place, moving a GLShader compiles it again
+            vec_GLShader shaders;
+            shaders.reserve(sources.size());
+
+            for (const auto& source : sources)
+                shaders.emplace_back(source.type, source.file_name);
+
+            GLProgram compiled{shaders};
+            prg = compiled.prg;
+
+            GLint success = 0;
+            glGetProgramiv(prg, GL_LINK_STATUS, &success);
+
+            if (!success)
+                return GLProgram{prg};
+
+            save_binary(key, prg);
+        }
+
+        return programs[names] = GLProgram{prg};
+    }
+
+private:
+    static void hash_bytes(std::uint64_t& hash, const String& bytes)
+    {
+        for (unsigned char c : bytes)
+        {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+    }
+
+    static String read_file(const String& file_name)
+    {
+        std::ifstream file(file_name, std::ios::binary);
+
+        return String(
+            (std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>()
+        );
+    }
+
+    static String gl_string(const GLenum& name)
+    {
+        const GLubyte* str = glGetString(name);
+
+        return str ? String(reinterpret_cast<const char*>(str)) : String();
+    }
+
+    /**
+     * The shader files and types, what a program is kept in memory under
+     */
+    static String names_key(const vec_Source& sources)
+    {
+        std::stringstream key;
+
+        for (const auto& source : sources)
+            key << source.type << ":" << source.file_name << ";";
+
+        return key.str();
+    }
+
+    /**
+     * The shader files and types plus a hash of everything that
+     * would make a stored binary unusable
+     */
+    String make_key(const vec_Source& sources)
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+        std::stringstream key;
+
+        key << names_key(sources);
+
+        for (const auto& source : sources)
+            hash_bytes(hash, read_file(source.file_name));
+
+        hash_bytes(hash, gl_string(GL_VENDOR));
+        hash_bytes(hash, gl_string(GL_RENDERER));
+        hash_bytes(hash, gl_string(GL_VERSION));
+
+        key << std::hex << hash;
+
+        return key.str();
+    }
+
+    String binary_path(const String& key)
+    {
+        // The hash is the last part of the key
+        return directory + "/" + key.substr(key.rfind(';') + 1) + ".bin";
+    }
+
+    GLuint load_binary(const String& key)
+    {
+        if (directory.empty())
+            return 0;
+
+        std::ifstream file(binary_path(key), std::ios::binary);
+
+        if (!file)
+            return 0;
+
+        GLenum format = 0;
+
+        if (!file.read(reinterpret_cast<char*>(&format), sizeof(format)))
+            return 0;
+
+        String data(
+            (std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>()
+        );
+
+        if (data.empty())
+            return 0;
+
+        GLuint prg = glCreateProgram();
+        glProgramBinary(prg, format, data.data(), static_cast<GLsizei>(data.size()));
+
+        // The driver may refuse a binary it made, for example after an update
+        GLint success = 0;
+        glGetProgramiv(prg, GL_LINK_STATUS, &success);
+
+        if (!success)
+        {
+            glDeleteProgram(prg);
+            return 0;
+        }
+
+        return prg;
+    }
+
+    void save_binary(const String& key, const GLuint& prg)
+    {
+        if (directory.empty() || !glIsProgram(prg))
+            return;
+
+        GLint length = 0;
+        glGetProgramiv(prg, GL_PROGRAM_BINARY_LENGTH, &length);
+
+        if (length <= 0)
+            return;
+
+        String data(length, '\0');
+        GLenum format = 0;
+        glGetProgramBinary(prg, length, nullptr, &format, &data[0]);
+
+        std::error_code err;
+        std::filesystem::create_directories(directory, err);
+
+        std::ofstream file(binary_path(key), std::ios::binary);
+
+        if (!file)
+        {
+            std::cout << "GLProgramCache WRITE ERROR\n\tCould not write " << binary_path(key) << "\n";
+            return;
+        }
+
+        file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+        file.write(data.data(), data.size());
+    }
+};
+
 #endif
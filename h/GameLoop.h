@@ -22,8 +22,18 @@
 
 #include <SDL2/SDL.h>
 #include <iostream>
+#include <iomanip>
 #include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <thread>
+
+#include "FrameStats.h"
+#include "Scheduler.h"
+#include "Trace.h"
 
 using u_int32 = std::uint_fast32_t;
 using String = std::string;
@@ -38,6 +48,22 @@ public:
     u_int32 time_now_ms = 0;
     bool is_running = true;
 
+    // Nanosecond timings of every phase, see FrameStats
+    FrameStats stats;
+
+    // Update on a thread of its own and draw what it publish()es,
+    // see pipeline_loop()
+    bool pipelined = false;
+
+    // Poll as fast as the loop runs instead of sleeping until the next
+    // update, frame or second tick, see sleep_until_next_deadline()
+    bool busy_wait = false;
+
+    // Draw this many frames as fast as they can be drawn, each one
+    // frame_rate() frame further along whatever the clock says,
+    // see offline_loop()
+    u_int32 offline_frames = 0;
+
     enum INTERPOLATIONS
     {
         ONE, TWO, THREE, FOUR
@@ -60,10 +86,42 @@ private:
 
     u_int32 tick_s = 0;
     u_int32 draw_count = 0;
-    u_int32 update_count = 0;
+    std::atomic< u_int32 > update_count{0};
 
     bool is_first_run = true;
 
+    // The last second of stats for console_output()
+    FrameStats::Window console_stats;
+
+    // When the last frame was drawn, unset after a pause
+    FrameStats::Clock::time_point last_frame;
+    bool has_last_frame = false;
+
+    // Time between the last two frames, negative until there were two
+    std::int64_t last_frame_ns = -1;
+
+    // Draw every render_frame_time with a continuous interpolation
+    // instead of partition_frame(), see set_render_rate()
+    bool paced = false;
+    u_int32 render_frames_per_second = 0;
+    FrameStats::Clock::duration render_frame_time{0};
+    FrameStats::Clock::time_point next_render_time;
+
+    // When the last update ran, what pace_frame() interpolates from
+    FrameStats::Clock::time_point last_update_time;
+
+    // Sleeps the main thread and the simulation thread
+    Scheduler scheduler;
+    Scheduler sim_scheduler;
+
+    // The simulation thread of pipeline_loop()
+    std::thread sim_thread;
+    std::atomic< bool > sim_running{false};
+    std::atomic< bool > sim_paused{false};
+
+    // When the simulation thread last publish()ed, in Clock ticks
+    std::atomic< FrameStats::Clock::rep > last_publish{0};
+
 public:
 
     /**
@@ -78,7 +136,26 @@ public:
         ip_speed = interpolations_per_frame;
     }
 
-    virtual ~GameLoop() {}
+    virtual ~GameLoop()
+    {
+        stop_simulation();
+    }
+
+    /**
+     * Draw frames_per_second frames a second, evenly spaced and each
+     * interpolated to when it is drawn, whatever the update rate is
+     *   0 draws as fast as the loop runs
+     *   Replaces the fixed INTERPOLATIONS per update
+     * @param frames_per_second
+     */
+    void set_render_rate(const u_int32& frames_per_second)
+    {
+        paced = true;
+        render_frames_per_second = frames_per_second;
+        render_frame_time = frames_per_second == 0 ? FrameStats::Clock::duration(0) :
+            std::chrono::duration_cast< FrameStats::Clock::duration >(
+                std::chrono::duration< double >(1.0 / frames_per_second));
+    }
 
     /**
      * Bootstrap the engine
@@ -92,12 +169,32 @@ public:
             rend = sdlWin.rend;
 
         init();
-        main_loop();
+
+        if (offline_frames > 0)
+            offline_loop();
+        else if (pipelined)
+            pipeline_loop();
+        else
+            main_loop();
+    }
+
+    /**
+     * Frames drawn per second of simulated time
+     *   The set_render_rate(), else (ip_speed + 1) per update
+     */
+    u_int32 frame_rate() const
+    {
+        if (paced && render_frames_per_second > 0)
+            return render_frames_per_second;
+
+        return frames_per_second * (static_cast<u_int32>(ip_speed) + 1);
     }
 
     void toggle_pause()
     {
         std::cout << "*** Paused ***\n";
+        sim_paused = true;
+
         SDL_Event pause_event = e;
         Uint32 type = pause_event.type;
         Uint32 code = pause_event.key.keysym.scancode;
@@ -108,6 +205,7 @@ public:
             SDL_WaitEvent(&e);
 
         reset_timers();
+        sim_paused = false;
     }
 
     virtual void init() {}
@@ -129,36 +227,72 @@ public:
 
         if ( is_first_run || time_count == 20)
         {
-            std::cout << "Time Passed\tUpdate Count\tDraw Count\n";
+            std::cout << "Time Passed\tUpdate Count\tDraw Count\t"
+                "Frame p50\tp99\tmax (ms)\tJitter p99\tCPU %\tSkips\tDrawn\tCulled\n";
 
             time_count = 0;
             is_first_run = false;
         }
 
+        console_stats.update(stats);
+        const HistogramWindow& frame = console_stats.phases[FrameStats::FRAME];
+        const HistogramWindow& jitter = console_stats.phases[FrameStats::JITTER];
+
         std::cout << time_now_ms/1000 << "\t\t" << update_count <<
-            "\t\t" << draw_count << "\n";
+            "\t\t" << draw_count << "\t\t" << std::fixed << std::setprecision(2) <<
+            frame.percentile(50) / 1e6 << "\t\t" << frame.percentile(99) / 1e6 <<
+            "\t" << frame.max() / 1e6 << "\t\t" << jitter.percentile(99) / 1e6 <<
+            "\t\t" << scheduler.utilization() * 100.0 << "\t" << console_stats.skips <<
+            "\t" << std::setprecision(0) << console_stats.drawn_per_frame() <<
+            "\t" << console_stats.culled_per_frame() << "\n";
+
+        std::cout.unsetf(std::ios::fixed);
 
         time_count++;
-        update_count = draw_count = 0;
+        update_count = 0;
+        draw_count = 0;
     }
 
     virtual void inputs(SDL_Event& e) {}
 
     virtual void collisions() {}
 
+    /**
+     * Hand the state of the update that just ran to the render thread
+     *   Only called when pipelined, on the simulation thread
+     */
+    virtual void publish() {}
+
     virtual void update_positions(const float& delta) {}
 
+    /**
+     * When pipelined this runs on the main thread while the next update
+     * runs on the simulation thread, so it reads what publish() handed over
+     */
     virtual void interpolate(const float& delta, const float& interpolation)
     {}
 
     virtual void draw() {}
 
+    /**
+     * Present the frame draw() made
+     *   Timed on its own since it is where the driver waits for the GPU
+     */
+    virtual void swap() {}
+
 private:
     void reset_timers()
     {
         time_now_ms = SDL_GetTicks();
         next_frame_time = time_now_ms + single_frame_time_in_ms;
         prev_frame_time = time_now_ms;
+
+        last_update_time = FrameStats::now();
+        next_render_time = last_update_time;
+
+        // The pause is not a slow frame
+        has_last_frame = false;
+        last_frame_ns = -1;
     }
 
     /**
@@ -187,6 +321,8 @@ private:
             {
                 if (e.window.event == SDL_WINDOWEVENT_FOCUS_LOST)
                 {
+                    sim_paused = true;
+
                     SDL_Event ev;
                     Uint32 type = e.type;
                     Uint32 win_event = SDL_WINDOWEVENT_FOCUS_GAINED;
@@ -195,6 +331,7 @@ private:
                         SDL_WaitEvent(&ev);
 
                     reset_timers();
+                    sim_paused = false;
                 }
                 break;
             }
@@ -226,71 +363,128 @@ private:
      */
     void interpolate_and_draw()
     {
+        FrameStats::Clock::time_point t = FrameStats::now();
+
         interpolate(delta_time, interpolation);
+        t = stats.record(FrameStats::INTERPOLATE, t);
+
         draw();
+        t = stats.record(FrameStats::DRAW, t);
+
+        swap();
+        t = stats.record(FrameStats::SWAP, t);
+
+        // Time from one frame on screen to the next
+        // and how much it changed since the frame before
+        if (has_last_frame)
+        {
+            stats.record(FrameStats::FRAME, last_frame);
+
+            const std::int64_t frame_ns =
+                std::chrono::duration_cast< std::chrono::nanoseconds >(t - last_frame).count();
+
+            if (last_frame_ns >= 0)
+                stats.phases[FrameStats::JITTER].record(static_cast<std::uint64_t>(
+                    frame_ns > last_frame_ns ? frame_ns - last_frame_ns : last_frame_ns - frame_ns));
+
+            last_frame_ns = frame_ns;
+        }
+
+        last_frame = t;
+        has_last_frame = true;
 
         draw_count++;
     }
 
+    /**
+     * Where in an update each of the (ip_speed + 1) frames is drawn
+     */
+    const float* partitions() const
+    {
+        static const float thresholds[4][4] = {
+            { 0.0f },
+            { 0.0f, 0.50f },
+            { 0.0f, 0.33f, 0.66f },
+            { 0.0f, 0.25f, 0.50f, 0.75f }
+        };
+
+        return thresholds[ip_speed];
+    }
+
     /**
      * Partition each frame for interpolation
      */
     void partition_frame()
     {
-        bool draw = false;
+        const float* thresholds = partitions();
 
-        if (!ip_flags[0] && interpolation >= 0.0f)
-        {
-            ip_flags[0] = true;
-            draw = true;
-        }
-        else if (ip_speed == INTERPOLATIONS::TWO)
-        {
-            if (!ip_flags[1] && interpolation >= 0.50f)
-            {
-                ip_flags[1] = true;
-                draw = true;
-            }
-        }
-        else if (ip_speed == INTERPOLATIONS::THREE)
+        // The next frame not drawn yet this update
+        for (int p = 0; p <= static_cast<int>(ip_speed); p++)
         {
-            if (!ip_flags[1] && interpolation >= 0.33f)
-            {
-                ip_flags[1] = true;
-                draw = true;
-            }
-            else if (!ip_flags[2] && interpolation >= 0.66f)
+            if (ip_flags[p])
+                continue;
+
+            if (interpolation >= thresholds[p])
             {
-                ip_flags[2] = true;
-                draw = true;
+                ip_flags[p] = true;
+                interpolate_and_draw();
             }
+
+            break;
         }
-        else if (ip_speed == INTERPOLATIONS::FOUR)
+    }
+
+    /**
+     * Draw when the next frame of set_render_rate() is due
+     *   Interpolated by the time since the last update, so each frame shows
+     *   where the particles are when it is drawn
+     */
+    void pace_frame()
+    {
+        const FrameStats::Clock::time_point now = FrameStats::now();
+
+        if (now < next_render_time)
+            return;
+
+        interpolation = std::min(1.0f, std::chrono::duration< float, std::milli >(
+            now - last_update_time).count() / single_frame_time_in_ms);
+
+        interpolate_and_draw();
+
+        // Drop the frames we were too slow for instead of drawing them back to back
+        next_render_time += render_frame_time;
+
+        if (next_render_time < now)
+            next_render_time = now + render_frame_time;
+    }
+
+    /**
+     * Run the pending events through check_for_quit() and inputs()
+     */
+    void poll_events()
+    {
+        FrameStats::Clock::time_point t = FrameStats::now();
+        stats.maybe_export(t);
+
+        // Only loops that had events count, most have none
+        if (SDL_PollEvent(&e))
         {
-            if (!ip_flags[1] && interpolation >= 0.25f)
-            {
-                ip_flags[1] = true;
-                draw = true;
-            }
-            else if (!ip_flags[2] && interpolation >= 0.50f)
-            {
-                ip_flags[2] = true;
-                draw = true;
-            }
-            else if (!ip_flags[3] && interpolation >= 0.75f)
+            do
             {
-                ip_flags[3] = true;
-                draw = true;
+                check_for_quit();
+                inputs(e);
             }
-        }
+            while (SDL_PollEvent(&e));
 
-        if (draw)
-            interpolate_and_draw();
+            // Unless we sat paused in there, see reset_timers()
+            if (has_last_frame)
+                stats.record(FrameStats::EVENTS, t);
+        }
     }
 
     /**
      * Main thread
-     *   Run events as fast as the loop runs
+     *   Run events as fast as the loop runs, sleeping when nothing is due
      *   Call virtual collision and position functions
      *      Frame skip if CPU can't keep up
      */
@@ -300,19 +494,21 @@ private:
         {
             time_now_ms = SDL_GetTicks();
 
-            while (SDL_PollEvent(&e))
-            {
-                check_for_quit();
-                inputs(e);
-            }
+            poll_events();
 
             frame_skips = 0;
 
             while( time_now_ms > next_frame_time && frame_skips < max_frame_skip)
             {
                 calc_delta_time();
+
+                FrameStats::Clock::time_point t = FrameStats::now();
                 update_positions(delta_time);
+                t = stats.record(FrameStats::UPDATE, t);
+
                 collisions();
+                stats.record(FrameStats::COLLISIONS, t);
+                stats.updates.fetch_add(1, std::memory_order_relaxed);
 
                 next_frame_time += single_frame_time_in_ms;
 
@@ -324,15 +520,243 @@ private:
                 update_count++;
             }
 
+            if (frame_skips > 0)
+                last_update_time = FrameStats::now();
+
+            // Updates run back to back to catch up, no frame was drawn between them
+            if (frame_skips > 1)
+                stats.skips.fetch_add(frame_skips - 1, std::memory_order_relaxed);
+
             interpolation =
                 static_cast<float>( time_now_ms +
                         single_frame_time_in_ms -
                         next_frame_time ) /
                 static_cast<float>( single_frame_time_in_ms );
 
-            partition_frame();
+            if (paced)
+                pace_frame();
+            else
+                partition_frame();
+
+            calc_second_timer();
+
+            if (!busy_wait)
+                sleep_until_next_deadline();
+        }
+    }
+
+    /**
+     * Sleep until the next update, frame or second tick is due
+     *   Events wait with them, nothing they do shows before the next frame
+     */
+    void sleep_until_next_deadline()
+    {
+        using Clock = FrameStats::Clock;
+
+        // Still catching up, or drawing as fast as we can
+        if (time_now_ms > next_frame_time || (paced && render_frame_time == Clock::duration(0)))
+            return;
+
+        // Milliseconds from now, an update runs once next_frame_time passed
+        std::int64_t due_ms = std::min< std::int64_t >(next_frame_time + 1, tick_s + 1000) -
+            static_cast<std::int64_t>(time_now_ms);
+
+        if (!paced)
+        {
+            const float* thresholds = partitions();
+
+            for (int p = 0; p <= static_cast<int>(ip_speed); p++)
+                if (!ip_flags[p])
+                {
+                    const std::int64_t draw_ms = static_cast<std::int64_t>(next_frame_time) -
+                        static_cast<std::int64_t>(time_now_ms) - single_frame_time_in_ms +
+                        static_cast<std::int64_t>(std::ceil(thresholds[p] * single_frame_time_in_ms));
+
+                    due_ms = std::min(due_ms, draw_ms);
+                    break;
+                }
+        }
+
+        const Clock::time_point now = FrameStats::now();
+        Clock::time_point deadline = now + std::chrono::milliseconds(due_ms);
+
+        if (paced)
+            deadline = std::min(deadline, next_render_time);
+
+        scheduler.sleep_until(deadline);
+    }
+
+    /**
+     * Main thread when drawing offline
+     *   Run events once per frame
+     *   Draw offline_frames frames, each 1 / frame_rate() seconds of
+     *      simulated time after the last, running the updates that fall
+     *      in between with an exact delta
+     *   Nothing waits for the clock, so this runs as fast as the frames
+     *      can be made
+     */
+    void offline_loop()
+    {
+        const float tick = 1.0f / frames_per_second;
+        const std::uint64_t rate = frame_rate();
+
+        // Update u runs at u / frames_per_second seconds and frame f
+        // is drawn at f / rate, compared in whole numbers so no update
+        // drifts into the wrong frame
+        std::uint64_t next_update = 0;
+
+        for (std::uint64_t f = 0; f < offline_frames && is_running; f++)
+        {
+            time_now_ms = SDL_GetTicks();
+
+            poll_events();
+
+            while (next_update * rate <= f * frames_per_second)
+            {
+                FrameStats::Clock::time_point t = FrameStats::now();
+                update_positions(tick);
+                t = stats.record(FrameStats::UPDATE, t);
+
+                collisions();
+                stats.record(FrameStats::COLLISIONS, t);
+                stats.updates.fetch_add(1, std::memory_order_relaxed);
+
+                next_update++;
+                update_count++;
+            }
+
+            // How far frame f is past the last update, in updates
+            delta_time = tick;
+            interpolation = static_cast<float>(f * frames_per_second - (next_update - 1) * rate) / rate;
+
+            interpolate_and_draw();
+            calc_second_timer();
+        }
+    }
+
+    /**
+     * Main thread when pipelined
+     *   Run events as fast as the loop runs, sleeping until the next frame
+     *   Interpolate and draw (ip_speed + 1) times per update, or at the
+     *      set_render_rate(), from whatever the simulation thread last published
+     *   The updates run on the simulation thread, see simulation_loop()
+     */
+    void pipeline_loop()
+    {
+        using Clock = FrameStats::Clock;
+
+        const Clock::duration tick = std::chrono::milliseconds(single_frame_time_in_ms);
+        const Clock::duration frame = paced ? render_frame_time :
+            tick / (static_cast<int>(ip_speed) + 1);
+
+        sim_running = true;
+        sim_thread = std::thread([this] { simulation_loop(); });
+
+        Clock::time_point next_draw = FrameStats::now();
+
+        while (is_running)
+        {
+            time_now_ms = SDL_GetTicks();
+
+            poll_events();
+
+            Clock::time_point now = FrameStats::now();
+
+            if (now >= next_draw)
+            {
+                // How far we are into the tick after the published one
+                const Clock::time_point published{Clock::duration(last_publish.load(std::memory_order_acquire))};
+
+                delta_time = single_frame_time_in_ms / 1000.0f;
+                interpolation = std::min(1.0f, std::chrono::duration< float >(now - published) /
+                    std::chrono::duration< float >(tick));
+
+                interpolate_and_draw();
+
+                // Drop the frames we were too slow for instead of drawing them back to back
+                next_draw += frame;
+
+                if (next_draw < now)
+                    next_draw = now + frame;
+            }
+            else if (!busy_wait)
+                scheduler.sleep_until(std::min(next_draw, now + std::chrono::milliseconds(
+                    static_cast<std::int64_t>(tick_s + 1000) - static_cast<std::int64_t>(time_now_ms))));
+
             calc_second_timer();
         }
+
+        stop_simulation();
+    }
+
+    /**
+     * Simulation thread
+     *   Call virtual position, collision and publish functions once
+     *      every tick with a fixed delta
+     *   Frame skip if CPU can't keep up
+     */
+    void simulation_loop()
+    {
+        using Clock = FrameStats::Clock;
+
+        TRACE_THREAD("simulation");
+
+        const Clock::duration tick = std::chrono::milliseconds(single_frame_time_in_ms);
+        const float delta = single_frame_time_in_ms / 1000.0f;
+
+        Clock::time_point next_update = FrameStats::now();
+
+        while (sim_running.load(std::memory_order_acquire))
+        {
+            // The pause is not time to catch up on
+            if (sim_paused.load(std::memory_order_acquire))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                next_update = FrameStats::now();
+                continue;
+            }
+
+            sim_scheduler.sleep_until(next_update);
+
+            u_int32 skips = 0;
+
+            while (FrameStats::now() >= next_update && skips < max_frame_skip)
+            {
+                FrameStats::Clock::time_point t = FrameStats::now();
+                update_positions(delta);
+                t = stats.record(FrameStats::UPDATE, t);
+
+                collisions();
+                t = stats.record(FrameStats::COLLISIONS, t);
+
+                publish();
+                t = stats.record(FrameStats::PUBLISH, t);
+                last_publish.store(t.time_since_epoch().count(), std::memory_order_release);
+
+                stats.updates.fetch_add(1, std::memory_order_relaxed);
+
+                next_update += tick;
+
+                skips++;
+                update_count++;
+            }
+
+            // Updates run back to back to catch up, no frame was drawn between them
+            if (skips > 1)
+                stats.skips.fetch_add(skips - 1, std::memory_order_relaxed);
+
+            // Too far behind to catch up, start over from now
+            if (FrameStats::now() >= next_update)
+                next_update = FrameStats::now() + tick;
+        }
+    }
+
+    void stop_simulation()
+    {
+        sim_running = false;
+
+        if (sim_thread.joinable())
+            sim_thread.join();
     }
 };
 
@@ -0,0 +1,130 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __MORTON_ORDER__
+#define __MORTON_ORDER__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ParticleStore.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+// Reorders the particles of a ParticleStore along a Z-order curve
+//
+// Particles are emitted at the emitter and a dead one is replaced by the
+// last one alive, so after a few seconds particles next to each other on
+// screen are anywhere in memory. Sorting them by the Morton code of their
+// position, the bits of x and y interleaved, puts particles that are close
+// on screen close in memory, so a grid cell's particles are a few runs of
+// the store and consecutive instances are drawn close together.
+//
+// sort() quantizes the positions to a 256 x 256 grid over their bounding
+// box, a few pixels a cell on screen, and sorts the 16 bit codes with an
+// LSD radix sort of two 8 bit digits. Each pass counts the digits of every chunk, prefix sums the
+// counts digit by digit then chunk by chunk and scatters each chunk in
+// order, so the sort is stable and the same on any number of threads.
+// Every array of the store is then gathered through the sorted order.
+//
+// step() sorts one of slices slices of the store each call, so a full
+// pass is spread over that many ticks. A slice is sorted on its own, so
+// the particles of a cell end up in at most slices runs.
+class MortonOrder{
+public:
+	// Sort one slice of the store per step(), 0 never sorts
+	std::size_t slices = 0;
+
+	// Bits of each coordinate in a code, and of a code in each radix digit
+	static constexpr unsigned bits = 8;
+	static constexpr unsigned digitBits = 8;
+	static constexpr std::size_t digits = std::size_t(1) << digitBits;
+
+	/**
+	 * Spread the low 16 bits of v to the even bits
+	 * @param v
+	 */
+	static std::uint32_t spread(std::uint32_t v)
+	{
+		v &= 0x0000ffff;
+		v = (v | (v << 8)) & 0x00ff00ff;
+		v = (v | (v << 4)) & 0x0f0f0f0f;
+		v = (v | (v << 2)) & 0x33333333;
+		v = (v | (v << 1)) & 0x55555555;
+
+		return v;
+	}
+
+	/**
+	 * Interleave the bits of x and y, x in the even bits
+	 * @param x
+	 * @param y
+	 */
+	static std::uint32_t code(const std::uint32_t& x, const std::uint32_t& y)
+	{
+		return spread(x) | (spread(y) << 1);
+	}
+
+	/**
+	 * Sort the particles [begin, end) of s by the Morton code of their position
+	 * @param s
+	 * @param begin
+	 * @param end
+	 * @param pool
+	 * @param chunk
+	 */
+	MortonOrder& sort(ParticleStore& s, const std::size_t& begin, const std::size_t& end,
+		ThreadPool* pool = nullptr, const std::size_t& chunk = 8192);
+
+	/**
+	 * Sort the next slice of s, when slices is set
+	 *   Slices are whole chunks so a chunk is always sorted as one
+	 * @param s
+	 * @param pool
+	 * @param chunk
+	 */
+	MortonOrder& step(ParticleStore& s, ThreadPool* pool = nullptr, const std::size_t& chunk = 8192);
+
+	/**
+	 * Start over from the first slice, so a replay sorts the same slices
+	 */
+	MortonOrder& rewind();
+
+private:
+	// The slice the next step() sorts
+	std::size_t next = 0;
+
+	// The code and slot in the range of each particle, sorted as pairs
+	std::vector< std::uint32_t > keys, keysOut;
+	std::vector< std::uint32_t > order, orderOut;
+
+	// Bounds, then digit counts and where each chunk scatters them, per chunk
+	std::vector< float > chunkBounds;
+	std::vector< std::uint32_t > chunkCounts;
+
+	// Each array gathered through order before it is copied back
+	ParticleStore::FloatArray gathered;
+	ParticleStore::IndexArray gatheredEmitter;
+
+	MortonOrder& radixPass(const std::size_t& n, const unsigned& shift,
+		ThreadPool* pool, const std::size_t& chunk);
+};
+
+#endif
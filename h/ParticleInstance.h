@@ -0,0 +1,37 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __PARTICLE_INSTANCE__
+#define __PARTICLE_INSTANCE__
+
+#include <cstdint>
+
+// What the renderer needs to draw one particle
+// This is the layout of the per instance vertex attributes
+struct ParticleInstance {
+	float x;
+	float y;
+	float radius;
+	// RGBA, one byte each in that order in memory
+	std::uint32_t color;
+};
+
+static_assert(sizeof(ParticleInstance) == 16, "ParticleInstance must stay tightly packed");
+
+#endif
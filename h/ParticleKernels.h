@@ -0,0 +1,116 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __PARTICLE_KERNELS__
+#define __PARTICLE_KERNELS__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ParticleInstance.h"
+
+// The screen edges particles bounce off or leave through
+struct EdgeParams {
+	// Particles closer than this to the bottom bounce
+	float floor = 10.0f;
+	// Particles completely past these are reset
+	float left = 0.0f;
+	float right = 800.0f;
+	// Vertical and horizontal velocity kept after a bounce
+	float bounce = -0.8f;
+	float friction = 0.9f;
+	// Bouncing particles slower than this are reset
+	float slow = 50.0f;
+};
+
+/**
+ * The hot loops of the simulation as plain functions over n particles
+ *
+ * Every pointer is the start of a range of one ParticleStore array.
+ * There is a scalar version and SSE2, AVX2 and AVX-512 versions picked
+ * at startup from what the CPU supports. All versions produce the same
+ * results as the scalar version within floating point rounding.
+ */
+struct ParticleKernels {
+	using String = std::string;
+
+	const char* name;
+
+	// vel += speed * dt
+	void (*movement)(float* velX, float* velY,
+		const float* speedX, const float* speedY,
+		std::size_t n, float dt);
+
+	// speedY -= g, where g is gravity * dt
+	void (*gravity)(float* speedY, std::size_t n, float g);
+
+	// pos = prev + vel * step
+	void (*integrate)(float* posX, float* posY,
+		const float* prevX, const float* prevY,
+		const float* velX, const float* velY,
+		std::size_t n, float step);
+
+	// movement, gravity and integrate fused into a single pass
+	void (*step)(float* posX, float* posY,
+		const float* prevX, const float* prevY,
+		float* velX, float* velY,
+		const float* speedX, float* speedY,
+		std::size_t n, float dt, float g);
+
+	// Bounce particles off the floor with damping and set reset[i] to 1
+	// for particles that bounced too slowly or left the screen, 0 otherwise
+	void (*bounce)(const float* posX, float* posY,
+		float* velX, float* velY,
+		const float* radius, std::uint8_t* reset,
+		std::size_t n, const EdgeParams& edge);
+
+	// speedY -= g[emitter[i]], gravity * dt looked up for each particle's emitter
+	// Lets particles of many emitters go through step() together with g = 0
+	void (*emitterGravity)(float* speedY, const std::uint16_t* emitter,
+		const float* g, std::size_t n);
+
+	// integrate into out[i] = { prev + vel * step, radius, color }
+	// Lets the renderer take interpolated positions without a copy
+	void (*instances)(ParticleInstance* out,
+		const float* prevX, const float* prevY,
+		const float* velX, const float* velY,
+		const float* radius, std::size_t n,
+		float step, std::uint32_t color);
+
+	/**
+	 * The best kernels this CPU supports
+	 *   Set PARTICLES_KERNELS to scalar, sse2, avx2 or avx512 to override
+	 */
+	static const ParticleKernels& get();
+
+	/**
+	 * The kernels with the given name
+	 *   Falls back to scalar when the CPU does not support them
+	 * @param name
+	 */
+	static const ParticleKernels& get(const String& name);
+
+	static const ParticleKernels& scalar();
+	static const ParticleKernels* sse2();
+	static const ParticleKernels* avx2();
+	static const ParticleKernels* avx512();
+};
+
+#endif
@@ -0,0 +1,75 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __PARTICLE_LOD__
+#define __PARTICLE_LOD__
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "Particle.h"
+
+// The unit circle mesh at several levels of detail
+//
+// Every level is a triangle fan in the same vertex buffer, from a
+// square up to 48 sides. A level is good for radii up to where its
+// sides fall tolerance pixels inside the circle, so small particles
+// are drawn with a few vertices and large ones stay round. See
+// ParticlesRenderer for how instances are sorted into levels.
+class ParticleLOD : public Particle {
+public:
+	struct Level {
+		// The fan's vertices in the position buffer
+		GLint first = 0;
+		GLsizei vertices = 0;
+
+		// The largest radius in pixels it is drawn at
+		GLfloat maxRadius = 0.0f;
+	};
+
+	// How far inside the circle a side may fall, in pixels
+	static constexpr GLfloat tolerance = 0.5f;
+
+	// Coarsest first
+	std::vector< Level > levels;
+
+	/**********************************************
+	*
+	*				OpenGL
+	*
+	***********************************************/
+	virtual ParticleLOD& fillBuffers();
+
+	/**
+	 * Index of the coarsest level good enough for radius
+	 * @param radius
+	 */
+	std::size_t level(const GLfloat& radius) const {
+		std::size_t l = 0;
+
+		while (l + 1 < this->levels.size() && radius > this->levels[l].maxRadius)
+			l++;
+
+		return l;
+	}
+};
+
+#endif
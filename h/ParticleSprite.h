@@ -0,0 +1,46 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __PARTICLE_SPRITE__
+#define __PARTICLE_SPRITE__
+
+#include <GL/glew.h>
+
+#include "Particle.h"
+
+// A particle drawn as one quad instead of a triangle fan
+//
+// There is no vertex buffer, glsl/quad.glsl makes the four corners
+// from gl_VertexID and glsl/fragment.glsl cuts the circle out of the
+// quad with its signed distance, so the edge is anti-aliased and
+// stays round at any radius or resolution. Four vertices per particle
+// instead of the eleven of the fan.
+class ParticleSprite : public Particle {
+public:
+	/**********************************************
+	*
+	*				OpenGL
+	*
+	***********************************************/
+	virtual ParticleSprite& compileShaders();
+	virtual ParticleSprite& fillBuffers();
+	virtual ParticleSprite& setVAOState();
+};
+
+#endif
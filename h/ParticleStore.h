@@ -0,0 +1,402 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __PARTICLE_STORE__
+#define __PARTICLE_STORE__
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <vector>
+
+/**
+ * Minimal allocator handing out memory aligned to a cache line so every
+ * array in ParticleStore starts on a boundary that vector loads like
+ */
+template <typename T, std::size_t Alignment>
+class AlignedAllocator
+{
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() noexcept {}
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(
+            ::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+        ::operator delete(p, std::align_val_t{Alignment});
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+/**
+ * Structure of arrays holding the simulation state of every particle
+ *
+ * Particle i is made of element i of each array. Keeping each value in its
+ * own contiguous array means a pass over the particles only pulls in the
+ * values it actually touches and the loops are trivially vectorizable.
+ *
+ * The arrays are allocated once for capacity() particles. The first size()
+ * of them are alive; add() takes the next free slot and remove() moves the
+ * last live particle into the hole, so the live ones stay packed at the
+ * front and nothing is allocated while particles come and go. To remove
+ * many at once compact() each chunk while it is in cache and closeGaps()
+ * after.
+ *
+ * Memory budget
+ *   11 floats and a 16 bit index per particle = 46 bytes per particle
+ *     posX, posY       current (or interpolated) position
+ *     prevX, prevY     position at the end of the last update
+ *     velX, velY       velocity in pixels per second
+ *     speedX, speedY   acceleration added to the velocity each update
+ *     radius           radius in pixels
+ *     age, lifetime    seconds alive and seconds to live
+ *     emitter          index of the emitter it came from, see EmitterSystem
+ *
+ *   1,000 particles     ~45 KB   (fits in L1/L2)
+ *   100,000 particles   ~4.4 MB  (fits in most L3 caches)
+ *   1,000,000 particles ~44 MB   (streams from memory)
+ *
+ * One updatePosition() moves roughly 100 bytes per particle through the
+ * cache, so 1M particles cost ~100 MB of memory traffic per tick. That is
+ * what sets the frame budget: at 30 updates per second one core has
+ * ~33 ms per tick and a 1M particle update is expected to take well under
+ * 10 ms of it.
+ */
+class ParticleStore
+{
+public:
+    static constexpr std::size_t alignment = 64;
+    static constexpr std::size_t floatsPerParticle = 11;
+    static constexpr std::size_t bytesPerParticle =
+        floatsPerParticle * sizeof(float) + sizeof(std::uint16_t);
+
+    using FloatArray = std::vector< float, AlignedAllocator< float, alignment > >;
+    using IndexArray = std::vector< std::uint16_t, AlignedAllocator< std::uint16_t, alignment > >;
+
+    FloatArray posX;
+    FloatArray posY;
+    FloatArray prevX;
+    FloatArray prevY;
+    FloatArray velX;
+    FloatArray velY;
+    FloatArray speedX;
+    FloatArray speedY;
+    FloatArray radius;
+    FloatArray age;
+    FloatArray lifetime;
+    IndexArray emitter;
+
+    /**
+     * Resize every array to hold n particles, all of them alive
+     * @param n
+     */
+    ParticleStore& resize(const std::size_t& n)
+    {
+        return reserve(n).grow(n);
+    }
+
+    /**
+     * Make room for n particles with none of them alive
+     * @param n
+     */
+    ParticleStore& reserve(const std::size_t& n)
+    {
+        for (auto array : arrays())
+            array->assign(n, 0.0f);
+
+        emitter.assign(n, 0);
+        count = 0;
+
+        return *this;
+    }
+
+    /**
+     * Bring the next n free particles to life, as many as fit
+     *   Their values are whatever the slots last held
+     * @param n
+     */
+    ParticleStore& grow(const std::size_t& n)
+    {
+        count = std::min(count + n, capacity());
+
+        return *this;
+    }
+
+    /**
+     * Take the next free particle
+     *   Returns its index, or capacity() when the store is full
+     */
+    std::size_t add()
+    {
+        return count < capacity() ? count++ : capacity();
+    }
+
+    /**
+     * Kill particle i by moving the last live particle into its place
+     * @param i
+     */
+    ParticleStore& remove(const std::size_t& i)
+    {
+        const std::size_t last = --count;
+
+        if (i != last)
+        {
+            for (auto array : arrays())
+                (*array)[i] = (*array)[last];
+
+            emitter[i] = emitter[last];
+        }
+
+        return *this;
+    }
+
+    /**
+     * Pack the particles of [begin, end) whose flag is not set at the
+     * front of the range and clear the flags
+     *   Like remove() but the hole is filled from the end of the range, so
+     *   the range stays in cache and ranges that do not overlap can be
+     *   compacted at the same time. See closeGaps() for what comes after
+     *   Returns how many are left
+     * @param begin
+     * @param end
+     * @param flags one per particle
+     */
+    std::size_t compact(const std::size_t& begin, const std::size_t& end, std::uint8_t* flags)
+    {
+        const auto all = arrays();
+        std::size_t last = end;
+        std::size_t i = begin;
+
+        while (i < last)
+        {
+            // Most particles are not marked so skip 8 flags at a time
+            if (i + 8 <= last)
+            {
+                std::uint64_t word;
+                std::memcpy(&word, flags + i, sizeof(word));
+
+                if (word == 0)
+                {
+                    i += 8;
+                    continue;
+                }
+            }
+
+            if (!flags[i])
+            {
+                i++;
+                continue;
+            }
+
+            // The last particle of the range takes this slot, check it again before moving on
+            last--;
+
+            for (auto array : all)
+                (*array)[i] = (*array)[last];
+
+            emitter[i] = emitter[last];
+            flags[i] = flags[last];
+            flags[last] = 0;
+        }
+
+        return last - begin;
+    }
+
+    /**
+     * Close the holes left by compact() on every chunk of chunkSize particles
+     *   live[c] is what compact() returned for chunk c and is overwritten.
+     *   The holes at the end of the first chunks are filled with particles
+     *   from the end of the last chunks, so only as many particles move as
+     *   died and they move in runs
+     * @param live one count per chunk
+     * @param chunkSize
+     */
+    ParticleStore& closeGaps(std::size_t* live, const std::size_t& chunkSize)
+    {
+        if (count == 0)
+            return *this;
+
+        std::size_t dst = 0;
+        std::size_t src = (count - 1) / chunkSize;
+
+        while (dst < src)
+        {
+            const std::size_t holes = std::min(chunkSize, count - dst * chunkSize) - live[dst];
+
+            if (holes == 0)
+            {
+                dst++;
+                continue;
+            }
+
+            if (live[src] == 0)
+            {
+                src--;
+                continue;
+            }
+
+            // Move a run from the end of the last chunk into the first hole
+            const std::size_t n = std::min(holes, live[src]);
+            const std::size_t from = src * chunkSize + live[src] - n;
+            const std::size_t to = dst * chunkSize + live[dst];
+
+            for (auto array : arrays())
+                std::copy(array->begin() + from, array->begin() + from + n, array->begin() + to);
+
+            std::copy(emitter.begin() + from, emitter.begin() + from + n, emitter.begin() + to);
+
+            live[src] -= n;
+            live[dst] += n;
+        }
+
+        // Every chunk before dst is full and the live ones of dst are at its front
+        count = dst * chunkSize + live[dst];
+
+        return *this;
+    }
+
+    /**
+     * Copy the values drawing reads of the live particles of from
+     *   prevX, prevY, velX, velY, radius and emitter, see Snapshot
+     *   Only allocates when the capacity of from changed
+     * @param from
+     */
+    ParticleStore& copyDrawn(const ParticleStore& from)
+    {
+        if (capacity() != from.capacity())
+            reserve(from.capacity());
+
+        const std::size_t n = from.size();
+
+        for (auto array : { &ParticleStore::prevX, &ParticleStore::prevY,
+                &ParticleStore::velX, &ParticleStore::velY, &ParticleStore::radius })
+            std::copy((from.*array).begin(), (from.*array).begin() + n, (this->*array).begin());
+
+        std::copy(from.emitter.begin(), from.emitter.begin() + n, emitter.begin());
+        count = n;
+
+        return *this;
+    }
+
+    /**
+     * Live particles
+     */
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    std::size_t capacity() const
+    {
+        return radius.size();
+    }
+
+    bool full() const
+    {
+        return count == capacity();
+    }
+
+    /**
+     * Bytes currently reserved by the store
+     */
+    std::size_t bytes() const
+    {
+        return capacity() * bytesPerParticle;
+    }
+
+    /**
+     * FNV-1a hash of the simulation state
+     *   Two runs that simulated the same thing hash the same
+     */
+    std::uint64_t checksum() const
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+
+        for (auto array : arrays())
+            for (std::size_t i = 0; i < count; i++)
+            {
+                std::uint32_t bits;
+                std::memcpy(&bits, &(*array)[i], sizeof(bits));
+
+                for (int b = 0; b < 4; b++)
+                {
+                    hash ^= (bits >> (b * 8)) & 0xff;
+                    hash *= 1099511628211ull;
+                }
+            }
+
+        for (std::size_t i = 0; i < count; i++)
+            for (int b = 0; b < 2; b++)
+            {
+                hash ^= (emitter[i] >> (b * 8)) & 0xff;
+                hash *= 1099511628211ull;
+            }
+
+        return hash;
+    }
+
+    /**
+     * Every float array, emitter is the only one that is not
+     */
+    std::array< const FloatArray*, floatsPerParticle > arrays() const
+    {
+        return {
+            &posX, &posY, &prevX, &prevY,
+            &velX, &velY, &speedX, &speedY,
+            &radius, &age, &lifetime
+        };
+    }
+
+    std::array< FloatArray*, floatsPerParticle > arrays()
+    {
+        return {
+            &posX, &posY, &prevX, &prevY,
+            &velX, &velY, &speedX, &speedY,
+            &radius, &age, &lifetime
+        };
+    }
+
+private:
+    std::size_t count = 0;
+};
+
+#endif
@@ -20,68 +20,161 @@
 #ifndef __PARTICLE_EMITTER__
 #define __PARTICLE_EMITTER__
 
-#include <SDL2/SDL.h>
-#include <GL/glew.h>
-#include <glm/glm.hpp>
-#include <glm/ext.hpp>
-
-#include <iostream>
-#include <vector>
-#include <string>
 #include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <cmath>
 #include <ctime>
 
-#include "Particle.h"
+#include "ForcePipeline.h"
+#include "ParticleInstance.h"
+#include "MortonOrder.h"
+#include "ParticleKernels.h"
+#include "ParticleStore.h"
+#include "Random.h"
+#include "SpatialGrid.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+// A plain 2D point so the simulation does not depend on glm
+struct Vec2 {
+	float x = 0.0f;
+	float y = 0.0f;
+};
 
+// The emitter and its simulation
+// Nothing in here touches SDL or OpenGL so it can run headless
+// See ParticlesRenderer for drawing
 class Particles{
 public:
-	// A vector and holds all of our particles
-	std::vector< Particle > particles;
+	// The simulation state of every particle, one array per value
+	// See ParticleStore.h for the per particle memory budget
+	ParticleStore store;
+
+	// Set to 1 by handleEdge() for each particle that has to be reset
+	// or, when emitting, removed
+	std::vector< std::uint8_t > reset;
+
+	// The loops that move the particles, picked for this CPU
+	// See ParticleKernels::get()
+	const ParticleKernels* kernels = &ParticleKernels::get();
+
+	// The screen edges our particles bounce off
+	EdgeParams edge;
+
+	// Split the work across these threads when set
+	ThreadPool* pool = nullptr;
+
+	// Particles per chunk of work, read by init()
+	// Small enough for a chunk of the store to stay in cache between kernels
+	std::size_t chunkSize = 8192;
+
+	// One random number stream per chunk
+	// Particles in a chunk are always reset in order by a single thread
+	// so results do not depend on how many threads there are
+	std::vector< Random > chunkRng;
+
+	// Seed of the random number streams, 0 seeds from the clock
+	// and init() keeps the one it picked here
+	// Two runs with the same seed simulate the same particles
+	std::uint32_t seed = 0;
 
 	// The position of our Emitter
-	glm::vec3 pos = {400.0f, 50.0f, 0.0f};
+	Vec2 pos = {400.0f, 50.0f};
+
+	// The color of our particles, RGBA bytes in memory
+	std::uint32_t color = 0xFFFFFFFF;
 
 	// The number of particles to emit
-	GLint numParticles = 100;
+	// With an emission rate this is the most that can be alive at once
+	int numParticles = 100;
+
+	// Particles emitted per second
+	// At 0 all numParticles are alive from init() and respawn at the emitter
+	// instead of dying, otherwise init() starts with none and dead particles
+	// go back to the pool
+	float emissionRate = 0.0f;
+
+	// Seconds each particle lives, picked between these when it is emitted
+	// A maxLifetime of 0 lives until it slows down or leaves the screen
+	float minLifetime = 0.0f;
+	float maxLifetime = 0.0f;
 
 	// The maximum radius of each particle
 	// This number is divided by 100.0f to get more variety in size
-	GLint maxRadius = 1000;
-	GLint minRadius = 250;
+	int maxRadius = 1000;
+	int minRadius = 250;
 
 	// The rate we will subtract from our particles vertical velocity each frame
-	GLfloat gravity = 750.0f;
+	float gravity = 750.0f;
 
 	// The maximum speed our particles move horizontally
 	// This value will be cut in half to make our particles move left and right of the origin
-	GLint maxSpeedX = 1000;
+	int maxSpeedX = 1000;
 
 	// The minimum and maximum initial vertical speed
-	GLint minSpeedY = 300;
-	GLint maxSpeedY = 450;
+	int minSpeedY = 300;
+	int maxSpeedY = 450;
+
+	// Let particles bounce off each other in collisions()
+	bool collide = false;
+	CollisionParams collision;
+
+	// Rebuilt by every collisions()
+	SpatialGrid grid;
+
+	// Sorts a slice of the particles along a Z-order curve after every
+	// updatePosition() when its slices is set, see MortonOrder
+	MortonOrder morton;
+
+	// Moves the particles in updatePosition() instead of the kernels when set,
+	// gravity is then left to the forces, see ForcePipeline
+	ForceStep forces;
 
 	Particles& init();
-	Particles& resetParticle(Particle& p);
+	Particles& resetParticle(const std::size_t& i);
+	Particles& burst(const std::size_t& count);
 
 	/**********************************************
 	*
 	*				Logic
 	*
 	***********************************************/
-	Particles& input(const SDL_Event& ev);
 	Particles& handleEdge();
 	Particles& handleMovement(const float& dt = 1);
 	Particles& addGravity(const float& dt = 1);
 	Particles& updatePosition(const float& dt = 1);
 	Particles& collisions();
 	Particles& interpolate(const float& dt = 1, const float& ip = 1);
+	Particles& interpolate(const float& dt, const float& ip, ParticleInstance* out);
+	const Particles& interpolate(const ParticleStore& from, const float& dt, const float& ip,
+		ParticleInstance* out, ThreadPool* threads) const;
 
 	/**********************************************
 	*
 	*				Draw
 	*
 	***********************************************/
-	Particles& draw();
+	Particles& writeInstances(ParticleInstance* out);
+
+private:
+	// The chunkSize init() split the streams and the store by
+	std::size_t chunk = 8192;
+
+	// Fraction of a particle left over from the last emit()
+	float emitted = 0.0f;
+
+	// Particles left in each chunk after edgeRange() when emitting
+	std::vector< std::size_t > chunkLive;
+
+	template <typename Fn>
+	void forEachChunk(const Fn& fn);
+
+	Particles& spawnRange(const std::size_t& begin, const std::size_t& end);
+	Particles& edgeRange(const std::size_t& begin, const std::size_t& end, const float& dt);
+	Particles& removeMarked();
+	Particles& emit(const float& dt);
 };
 
 #endif
@@ -0,0 +1,184 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __PARTICLES_RENDERER__
+#define __PARTICLES_RENDERER__
+
+#include <SDL2/SDL.h>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ComputeParticles.h"
+#include "EmitterSystem.h"
+#include "Particle.h"
+#include "ParticleInstance.h"
+#include "ParticleLOD.h"
+#include "ParticleSprite.h"
+#include "Particles.h"
+#include "Snapshot.h"
+#include "StreamBuffer.h"
+
+// Draws the particles simulated by Particles
+// This is the only place the simulation meets OpenGL
+//
+// Every particle shares one unit circle mesh, or with sprites one quad
+// the fragment shader cuts an anti-aliased circle out of. The position,
+// radius and color of each particle go in a per instance buffer and all
+// of them are drawn with a single glDrawArraysInstanced
+//
+// With persistent mapping the instances are interpolated straight into
+// a triple buffered StreamBuffer, so there is no copy and no upload
+//
+// ComputeParticles write their instances on the GPU and are drawn
+// straight from its buffer
+//
+// An EmitterSystem writes its instances grouped by material and each
+// material is drawn with one call
+//
+// The circle mesh has levels of detail by radius, see ParticleLOD. The
+// instances are then written to a staging vector and sorted by level
+// into where the draw reads them, and each level is one call
+//
+// Instances that are off the viewport or too small to see are left out
+// before they are uploaded, see cull
+//
+// When the simulation runs on its own thread the instances are written
+// from the Snapshot of its last tick instead, see GameLoop::pipelined
+class ParticlesRenderer{
+public:
+	// How the particles of a material are blended into the frame
+	struct Material {
+		bool blend = false;
+		GLenum src = GL_ONE;
+		GLenum dst = GL_ZERO;
+	};
+
+	// Indexed by Emitter::material, Particles are drawn with the first
+	// Emitters with a material past the end use the last one
+	std::vector< Material > materials = {
+		Material{},
+		Material{ true, GL_ONE, GL_ONE }
+	};
+
+	// Draw each particle as a ParticleSprite quad instead of the
+	// circle mesh, set before init()
+	bool sprites = true;
+
+	// Hold the shader program and the unit circle meshes or quad
+	ParticleLOD circle;
+	ParticleSprite sprite;
+
+	// Leave out the instances outside the viewport the mesh's projection
+	// maps onto, and those with a radius under minPixels, before the
+	// upload. Not for ComputeParticles, their instances stay on the GPU
+	bool cull = true;
+	GLfloat minPixels = 0.5f;
+
+	// What the particles are drawn with, coarsest first, one for sprites
+	std::vector< ParticleLOD::Level > levels;
+
+	// The per instance attributes, refilled before every draw
+	std::vector< ParticleInstance > instances;
+
+	// The per instance attribute buffer when persistent mapping is not available
+	GLuint instanceBuffer = 0;
+
+	// Three mapped regions of instances the CPU writes while the GPU reads
+	StreamBuffer stream;
+	bool persistent = false;
+
+	// Instances written for the next draw
+	std::size_t drawCount = 0;
+
+	// Where each level of each material starts in them, see drawInstances()
+	std::vector< std::size_t > drawRanges;
+
+	// Instances the last write left out, see cull
+	std::size_t culled = 0;
+
+	virtual ~ParticlesRenderer();
+
+	ParticlesRenderer& init(const Particles& ps);
+	ParticlesRenderer& init(const EmitterSystem& es);
+
+	/**********************************************
+	*
+	*				OpenGL
+	*
+	***********************************************/
+	bool reserve(const std::size_t& count);
+	ParticlesRenderer& useInstanceBuffer();
+	ParticlesRenderer& setInstanceState(const GLuint& buffer);
+	ParticlesRenderer& upload(Particles& ps);
+	ParticlesRenderer& uploadInstances();
+
+	/**********************************************
+	*
+	*				Logic
+	*
+	***********************************************/
+	ParticlesRenderer& interpolate(Particles& ps, const float& dt, const float& ip);
+	ParticlesRenderer& interpolate(EmitterSystem& es, const float& dt, const float& ip);
+	ParticlesRenderer& interpolate(const Particles& ps, const Snapshot& snap, const float& ip);
+	ParticlesRenderer& interpolate(EmitterSystem& es, const Snapshot& snap, const float& ip);
+
+	/**********************************************
+	*
+	*				Draw
+	*
+	***********************************************/
+	ParticlesRenderer& draw(Particles& ps);
+	ParticlesRenderer& draw(ComputeParticles& cps);
+	ParticlesRenderer& draw(EmitterSystem& es);
+	ParticlesRenderer& drawWritten();
+
+private:
+	// The buffer the mesh's VAO reads instances from
+	GLuint boundBuffer = 0;
+
+	// Written by interpolate() and sorted into levels by sortLevels()
+	std::vector< ParticleInstance > staging;
+	std::vector< std::size_t > levelRanges;
+	std::vector< std::size_t > levelCursors;
+
+	// Written by cullInstances(), one flag per instance and
+	// where each block of them goes once compacted
+	static constexpr std::size_t cullBlock = 1024;
+	std::vector< std::uint8_t > visible;
+	std::vector< std::size_t > blockOffsets;
+
+	ParticlesRenderer& init(const std::size_t& capacity);
+	Particle& mesh();
+	ParticlesRenderer& bindInstances();
+	ParticleInstance* beginWrite(const std::size_t& count, const std::size_t& capacity);
+	ParticleInstance* destination(const std::size_t& count, const std::size_t& capacity);
+	ParticlesRenderer& endWrite(const std::size_t& count, const std::size_t& capacity,
+		const std::vector< std::size_t >* ranges = nullptr);
+	ParticlesRenderer& cullInstances(ParticleInstance* out);
+	ParticlesRenderer& sortLevels(ParticleInstance* out);
+	ParticlesRenderer& drawInstances(const GLuint& baseInstance,
+		const std::vector< std::size_t >& ranges, const std::size_t& levelsPerMaterial);
+};
+
+#endif
@@ -0,0 +1,244 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __RANDOM__
+#define __RANDOM__
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * xoshiro128++ random numbers, several independent streams side by side
+ *
+ * Each of the lanes streams has its own 128 bits of state. One step()
+ * advances every lane at once with the same adds, xors and shifts, so
+ * the compiler turns it into a few vector instructions. The numbers come
+ * out lane 0, lane 1, ... lane 7, then the next step, whether they are
+ * taken one at a time or with fill(), so both give the same sequence.
+ *
+ * The same seed and stream always give the same numbers. Give every
+ * thread, chunk or emitter its own stream instead of sharing one
+ * generator so the results do not depend on who runs first.
+ */
+class Random
+{
+public:
+    static constexpr std::size_t lanes = 8;
+
+    /**
+     * Constructor
+     * @param seed
+     * @param stream streams of the same seed are unrelated
+     */
+    explicit Random(std::uint64_t seed = 1, std::uint64_t stream = 0)
+    {
+        this->seed(seed, stream);
+    }
+
+    /**
+     * Start over from seed and stream
+     * @param seed
+     * @param stream
+     */
+    Random& seed(std::uint64_t seed, std::uint64_t stream = 0)
+    {
+        // splitmix64 spreads the seed over the state of every lane
+        // so close seeds and streams still start far apart
+        std::uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ull);
+
+        for (std::size_t l = 0; l < lanes; l++)
+        {
+            const std::uint64_t a = splitmix(x);
+            const std::uint64_t b = splitmix(x);
+
+            s0[l] = static_cast<std::uint32_t>(a);
+            s1[l] = static_cast<std::uint32_t>(a >> 32);
+            s2[l] = static_cast<std::uint32_t>(b);
+            s3[l] = static_cast<std::uint32_t>(b >> 32);
+
+            // All zero is the one state xoshiro never leaves
+            if ((a | b) == 0)
+                s0[l] = 1;
+        }
+
+        next = lanes;
+
+        return *this;
+    }
+
+    /**
+     * The next 32 random bits
+     */
+    std::uint32_t operator()()
+    {
+        if (next == lanes)
+        {
+            step(buffer);
+            next = 0;
+        }
+
+        return buffer[next++];
+    }
+
+    /**
+     * A float in [0, 1)
+     */
+    float uniform()
+    {
+        return toUnit((*this)());
+    }
+
+    /**
+     * A float in [lo, hi)
+     * @param lo
+     * @param hi
+     */
+    float uniform(float lo, float hi)
+    {
+        return lo + (hi - lo) * uniform();
+    }
+
+    /**
+     * An integer in [0, n) without the bias or the divide of rng() % n
+     * @param n
+     */
+    std::uint32_t below(std::uint32_t n)
+    {
+        return static_cast<std::uint32_t>((static_cast<std::uint64_t>((*this)()) * n) >> 32);
+    }
+
+    /**
+     * Fill out with n times 32 random bits
+     *   The same numbers n calls to operator() would give
+     * @param out
+     * @param n
+     */
+    Random& fill(std::uint32_t* out, std::size_t n)
+    {
+        std::size_t i = 0;
+
+        // Use up what is left of the last step first
+        for (; i < n && next < lanes; i++)
+            out[i] = buffer[next++];
+
+        // Then whole steps straight into out
+        for (; i + lanes <= n; i += lanes)
+            step(out + i);
+
+        for (; i < n; i++)
+            out[i] = (*this)();
+
+        return *this;
+    }
+
+    /**
+     * Fill out with n floats in [lo, hi)
+     *   The same numbers n calls to uniform(lo, hi) would give
+     * @param out
+     * @param n
+     * @param lo
+     * @param hi
+     */
+    Random& fill(float* out, std::size_t n, float lo, float hi)
+    {
+        const float range = hi - lo;
+        std::uint32_t bits[lanes];
+
+        for (std::size_t i = 0; i < n; i += lanes)
+        {
+            const std::size_t m = n - i < lanes ? n - i : lanes;
+
+            fill(bits, m);
+
+            for (std::size_t l = 0; l < m; l++)
+                out[i + l] = lo + range * toUnit(bits[l]);
+        }
+
+        return *this;
+    }
+
+private:
+    alignas(32) std::uint32_t s0[lanes];
+    alignas(32) std::uint32_t s1[lanes];
+    alignas(32) std::uint32_t s2[lanes];
+    alignas(32) std::uint32_t s3[lanes];
+
+    // The numbers of the last step and the next one to hand out
+    alignas(32) std::uint32_t buffer[lanes];
+    std::size_t next = lanes;
+
+    static std::uint64_t splitmix(std::uint64_t& x)
+    {
+        std::uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    static std::uint32_t rotl(std::uint32_t x, int k)
+    {
+        return (x << k) | (x >> (32 - k));
+    }
+
+    // The top 24 bits are exactly representable as a float in [0, 1)
+    static float toUnit(std::uint32_t bits)
+    {
+        return (bits >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // Advance every lane one xoshiro128++ step
+    void step(std::uint32_t* out)
+    {
+        // Work on copies so the compiler knows out does not overlap the state
+        std::uint32_t a[lanes], b[lanes], c[lanes], d[lanes], r[lanes];
+
+        for (std::size_t l = 0; l < lanes; l++)
+        {
+            a[l] = s0[l];
+            b[l] = s1[l];
+            c[l] = s2[l];
+            d[l] = s3[l];
+        }
+
+        for (std::size_t l = 0; l < lanes; l++)
+        {
+            r[l] = rotl(a[l] + d[l], 7) + a[l];
+
+            const std::uint32_t t = b[l] << 9;
+
+            c[l] ^= a[l];
+            d[l] ^= b[l];
+            b[l] ^= c[l];
+            a[l] ^= d[l];
+            c[l] ^= t;
+            d[l] = rotl(d[l], 11);
+        }
+
+        for (std::size_t l = 0; l < lanes; l++)
+        {
+            s0[l] = a[l];
+            s1[l] = b[l];
+            s2[l] = c[l];
+            s3[l] = d[l];
+            out[l] = r[l];
+        }
+    }
+};
+
+#endif
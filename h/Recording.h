@@ -0,0 +1,154 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __RECORDING__
+#define __RECORDING__
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#include "EmitterSystem.h"
+#include "Particles.h"
+
+// A recording is "PREC", a version and then records, each one byte
+// saying what it is followed by its values in the byte order of the
+// machine that wrote it (little endian on everything we build for)
+//
+//   Particles   the setup of a Particles, once before the first tick
+//   Emitters    or the setup of an EmitterSystem and its emitters
+//   Ticks       count and dt, count updates of dt seconds each
+//   Input       type and code of an input event before the next tick
+//   Checksum    ParticleStore::checksum() after the last tick
+//   End
+//
+// Ticks with the same dt share one record, so a fixed time step costs
+// a few bytes however long it runs. Everything the simulation draws at
+// random comes from the recorded seed so nothing else is needed to
+// step it the same way again.
+enum class RecordKind : std::uint8_t {
+	Particles = 'P',
+	Emitters = 'E',
+	Ticks = 'T',
+	Input = 'I',
+	Checksum = 'C',
+	End = 'X'
+};
+
+// Writes a recording of one run
+class Recorder{
+public:
+	static constexpr std::uint32_t version = 2;
+
+	// Write a Checksum record after every tick so a replay can tell
+	// on which tick it went different
+	bool checksums = false;
+
+	~Recorder();
+
+	/**
+	 * Start a new recording at path
+	 *   Returns false when the file can not be written
+	 * @param path
+	 */
+	bool open(const std::string& path);
+	bool isOpen() const;
+
+	// The setup after init(), once before the first tick
+	Recorder& setup(const Particles& ps);
+	Recorder& setup(const EmitterSystem& es);
+
+	Recorder& tick(const float& dt);
+	Recorder& input(const std::uint32_t& type, const std::int32_t& code);
+	Recorder& checksum(const ParticleStore& store);
+
+	// Write the End record, also done when the recorder goes away
+	Recorder& close();
+
+private:
+	std::ofstream out;
+
+	// A pipelined GameLoop ticks on the simulation thread and
+	// takes inputs on the main thread
+	std::mutex lock;
+
+	// Ticks not written yet, all of runDt seconds
+	std::uint32_t runCount = 0;
+	float runDt = 0.0f;
+
+	Recorder& flushTicks();
+};
+
+// Reads a recording back
+//
+//   Replay replay;
+//   replay.open(path);
+//   while (replay.next(record))
+//       ...
+//
+// The setup record fills in particles or system, ready for init().
+class Replay{
+public:
+	struct Record {
+		RecordKind kind = RecordKind::End;
+
+		// Ticks
+		std::uint32_t count = 0;
+		float dt = 0.0f;
+
+		// Input
+		std::uint32_t type = 0;
+		std::int32_t code = 0;
+
+		// Checksum
+		std::uint64_t checksum = 0;
+	};
+
+	std::uint32_t version = 0;
+
+	// Set up from the recording, whichever of the two it recorded
+	Particles particles;
+	EmitterSystem system;
+
+	// Name of the kernels the recording ran with
+	std::string kernels;
+
+	/**
+	 * Open the recording at path and check its version
+	 *   Returns false, and says why, when it can not be replayed
+	 * @param path
+	 */
+	bool open(const std::string& path);
+
+	/**
+	 * Read the next record
+	 *   Returns false at the end of the recording
+	 * @param record
+	 */
+	bool next(Record& record);
+
+private:
+	std::ifstream in;
+
+	bool readKernels();
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __SCHEDULER__
+#define __SCHEDULER__
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <thread>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <time.h>
+#endif
+
+/**
+ * Sleeps a thread until a deadline without burning a core
+ *
+ * The OS wakes a sleeping thread late by anything from tens of
+ * microseconds to a millisecond or two. sleep_until() sleeps until
+ * margin before the deadline and spins the rest, and the margin follows
+ * how late the OS has been waking us, so deadlines are met as well as
+ * a busy loop meets them at a fraction of the CPU time.
+ *
+ * utilization() is the CPU time of the whole process over the wall time
+ * since the last call, so 1.0 is one core kept busy.
+ */
+class Scheduler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Never spin less or more than this before a deadline
+    static constexpr std::chrono::microseconds min_margin{50};
+    static constexpr std::chrono::microseconds max_margin{2000};
+
+    // Spun or slept past the deadline by more than this
+    static constexpr std::chrono::microseconds late_after{500};
+
+    std::uint64_t sleeps = 0;
+    std::uint64_t late = 0;
+
+    Scheduler()
+    {
+        utilization();
+    }
+
+    /**
+     * Return at deadline, sleeping as much of the wait as we can
+     *   Returns straight away when it already passed
+     * @param deadline
+     */
+    void sleep_until(const Clock::time_point& deadline)
+    {
+        Clock::time_point now = Clock::now();
+
+        if (now >= deadline)
+            return;
+
+        const Clock::time_point wake = deadline - margin;
+
+        if (now < wake)
+        {
+            os_sleep_until(wake);
+            now = Clock::now();
+
+            // How late the OS woke us, the margin keeps twice the recent average
+            const Clock::duration over = std::max(Clock::duration(0), now - wake);
+            oversleep += (over - oversleep) / 8;
+            margin = std::clamp< Clock::duration >(oversleep * 2, min_margin, max_margin);
+        }
+
+        while (now < deadline)
+        {
+            std::this_thread::yield();
+            now = Clock::now();
+        }
+
+        sleeps++;
+
+        if (now - deadline > late_after)
+            late++;
+    }
+
+    /**
+     * CPU time of the process over wall time since the last call
+     */
+    double utilization()
+    {
+        const std::clock_t cpu = std::clock();
+        const Clock::time_point wall = Clock::now();
+
+        const double used = static_cast<double>(cpu - last_cpu) / CLOCKS_PER_SEC;
+        const double passed = std::chrono::duration< double >(wall - last_wall).count();
+
+        last_cpu = cpu;
+        last_wall = wall;
+
+        return passed > 0.0 ? used / passed : 0.0;
+    }
+
+private:
+    Clock::duration margin = std::chrono::microseconds(500);
+    Clock::duration oversleep{0};
+
+    std::clock_t last_cpu = 0;
+    Clock::time_point last_wall;
+
+    /**
+     * An absolute sleep on the clock of steady_clock when we have one,
+     * so a wakeup that was interrupted does not sleep the whole wait again
+     * @param wake
+     */
+    static void os_sleep_until(const Clock::time_point& wake)
+    {
+#if defined(__linux__)
+        const auto since = std::chrono::duration_cast< std::chrono::nanoseconds >(wake.time_since_epoch()).count();
+
+        timespec ts;
+        ts.tv_sec = static_cast<time_t>(since / 1000000000);
+        ts.tv_nsec = static_cast<long>(since % 1000000000);
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        {}
+#else
+        std::this_thread::sleep_until(wake);
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,243 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __SPATIAL_GRID__
+#define __SPATIAL_GRID__
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ParticleStore.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+// How overlapping particles push each other apart
+struct CollisionParams {
+	// Normal velocity kept after a hit, 1 is elastic and 0 stops dead
+	float restitution = 0.5f;
+	// Share of the overlap pushed apart each tick
+	float separation = 0.8f;
+};
+
+// Uniform grid of square cells over the particles
+//
+// build() puts every particle in the bucket of the cell its center is in
+// and sorts the particle indices by bucket with an LSD radix sort of 8 bit
+// digits, as many as the buckets need, like MortonOrder. Each pass counts
+// the digits of every chunk, prefix sums them and scatters each chunk in
+// order. A bucket then starts at the first particle sorted into it.
+// With cells at least as wide as the largest particle, everything a
+// particle can touch is in the 3x3 cells around it, so a query costs
+// the same at 1k particles as at 1M and a tick is O(n).
+//
+// The cells of the bounding box are numbered row by row so the three
+// cells of a row sit next to each other in memory. When the particles
+// are spread too thin for that, a few far away from the rest, the cells
+// are hashed into 2 to 4 buckets per particle instead.
+//
+// The sort is stable so each bucket is sorted by index and the results
+// do not depend on the number of threads, and a crowded bucket is split
+// across the chunks like any other.
+//
+// A particle in a crowd, where many particles share its cells, tests at
+// most maxPairs of its neighbours a tick, spread over the crowd, so a
+// tick stays O(n) when every particle starts at the emitter.
+class SpatialGrid{
+public:
+	float cellSize = 1.0f;
+
+	// Neighbours collide() tests per particle at most
+	static constexpr std::uint32_t maxPairs = 64;
+
+	// Bits of a bucket sorted by each radix pass
+	static constexpr unsigned digitBits = 8;
+	static constexpr std::size_t digits = std::size_t(1) << digitBits;
+
+	// Bucket b holds particles[bucketStart[b]] to particles[bucketStart[b + 1]]
+	std::vector< std::uint32_t > bucketStart;
+	std::vector< std::uint32_t > particles;
+
+	SpatialGrid& build(const float* x, const float* y, const std::size_t& n,
+		const float& cell, ThreadPool* pool = nullptr, const std::size_t& chunk = 8192);
+
+	/**
+	 * Call fn(k) for each slot k of particles in the 3x3 cells around (x, y)
+	 *   particles[k] is the particle. Includes particles that only share a
+	 *   bucket with those cells, the caller checks the distance
+	 * @param x
+	 * @param y
+	 * @param fn
+	 * @param stride only every stride-th slot
+	 * @param skip slots skipped before the first, less than stride
+	 */
+	template <typename Fn>
+	void query(const float& x, const float& y, const Fn& fn,
+		const std::uint32_t& stride = 1, std::uint32_t skip = 0) const
+	{
+		this->runs(x, y, [&](std::uint32_t k, const std::uint32_t& end) {
+			for (k += skip; k < end; k += stride)
+				fn(k);
+
+			skip = k - end;
+		});
+	}
+
+	/**
+	 * Slots query() visits around (x, y) with a stride of 1
+	 * @param x
+	 * @param y
+	 */
+	std::uint32_t count(const float& x, const float& y) const
+	{
+		std::uint32_t found = 0;
+
+		this->runs(x, y, [&](const std::uint32_t& begin, const std::uint32_t& end) {
+			found += end - begin;
+		});
+
+		return found;
+	}
+
+	/**
+	 * Build the grid from the particles of s and push overlapping ones apart
+	 *   Each particle only writes itself so the particles are split across threads
+	 * @param s
+	 * @param params
+	 * @param cell at least twice the largest radius
+	 * @param pool
+	 * @param chunk
+	 */
+	SpatialGrid& collide(ParticleStore& s, const CollisionParams& params,
+		const float& cell, ThreadPool* pool = nullptr, const std::size_t& chunk = 8192);
+
+private:
+	/**
+	 * Sort bucketOf and particles by the digit of each bucket at shift
+	 *   Leaves the sorted pairs back in bucketOf and particles
+	 */
+	SpatialGrid& radixPass(const std::size_t& n, const unsigned& shift,
+		ThreadPool* pool, const std::size_t& chunk);
+
+	/**
+	 * Call fn(begin, end) for each run of slots in the 3x3 cells around (x, y)
+	 * @param x
+	 * @param y
+	 * @param fn
+	 */
+	template <typename Fn>
+	void runs(const float& x, const float& y, const Fn& fn) const
+	{
+		const std::int64_t col = cellOf(x) - this->minCX;
+		const std::int64_t row = cellOf(y) - this->minCY;
+
+		// Numbered cells: the three cells of a row are one run of slots
+		if (this->mask == 0)
+		{
+			const std::int64_t first = std::max< std::int64_t >(col - 1, 0);
+			const std::int64_t last = std::min< std::int64_t >(col + 1, this->columns - 1);
+
+			for (std::int64_t r = std::max< std::int64_t >(row - 1, 0);
+					r <= std::min< std::int64_t >(row + 1, this->rows - 1); r++)
+			{
+				const std::uint32_t* start = this->bucketStart.data() + r * this->columns;
+
+				fn(start[first], start[last + 1]);
+			}
+
+			return;
+		}
+
+		// Two cells can hash to the same bucket, visit each bucket once
+		std::uint32_t seen[9];
+		int visited = 0;
+
+		for (std::int64_t dy = -1; dy <= 1; dy++)
+			for (std::int64_t dx = -1; dx <= 1; dx++)
+			{
+				const std::uint32_t b = hash(col + dx, row + dy);
+
+				bool repeat = false;
+				for (int v = 0; v < visited; v++)
+					repeat |= seen[v] == b;
+
+				if (repeat)
+					continue;
+
+				seen[visited++] = b;
+
+				fn(this->bucketStart[b], this->bucketStart[b + 1]);
+			}
+	}
+
+	// The cells of the bounding box, see bucket()
+	std::int64_t minCX = 0, minCY = 0, columns = 1, rows = 1;
+	float invCellSize = 1.0f;
+
+	// 0 numbers the cells row by row, else buckets - 1 to hash them
+	std::uint32_t mask = 0;
+
+	// Bucket of each particle, sorted along with particles while building
+	std::vector< std::uint32_t > bucketOf;
+
+	// The other half of each radix pass and where each chunk scatters each digit
+	std::vector< std::uint32_t > keysOut, particlesOut;
+	std::vector< std::uint32_t > chunkCounts;
+
+	// Bounds of each chunk
+	std::vector< float > chunkBounds;
+
+	// The particles copied in bucket order so neighbours are close in memory
+	// then the velocity and position change of each one
+	ParticleStore::FloatArray sortedX, sortedY, sortedVX, sortedVY, sortedR;
+	ParticleStore::FloatArray dvX, dvY, dpX, dpY;
+
+	// floor(v / cellSize) without a call into libm
+	std::int64_t cellOf(const float& v) const
+	{
+		const float f = v * this->invCellSize;
+		const std::int64_t t = static_cast<std::int64_t>(f);
+
+		return t - (f < static_cast<float>(t));
+	}
+
+	std::uint32_t hash(const std::int64_t& col, const std::int64_t& row) const
+	{
+		return (static_cast<std::uint32_t>(col) * 73856093u ^
+			static_cast<std::uint32_t>(row) * 19349663u) & this->mask;
+	}
+
+	/**
+	 * The bucket of the particle at (x, y)
+	 */
+	std::uint32_t bucket(const float& x, const float& y) const
+	{
+		const std::int64_t col = cellOf(x) - this->minCX;
+		const std::int64_t row = cellOf(y) - this->minCY;
+
+		if (this->mask == 0)
+			return static_cast<std::uint32_t>(row * this->columns + col);
+
+		return hash(col, row);
+	}
+};
+
+#endif
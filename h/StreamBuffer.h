@@ -0,0 +1,189 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __STREAM_BUFFER__
+#define __STREAM_BUFFER__
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+#include "Trace.h"
+
+/**
+ * A persistently mapped buffer split into three regions
+ *
+ * The CPU writes the next frame straight into mapped GPU memory while
+ * the GPU may still be reading the two previous frames. Each region is
+ * fenced after the draw that reads it and the CPU only waits on a fence
+ * if it laps the GPU, so there is no copy and normally no stall.
+ *
+ * Needs glBufferStorage (GL 4.4 or ARB_buffer_storage), see supported().
+ */
+class StreamBuffer
+{
+public:
+    static constexpr int regions = 3;
+
+    GLuint buffer = 0;
+
+private:
+    GLenum target = GL_ARRAY_BUFFER;
+    GLsizeiptr region_bytes = 0;
+    std::uint8_t* mapped = nullptr;
+    GLsync fences[regions] = {nullptr, nullptr, nullptr};
+    int region = 0;
+
+public:
+    StreamBuffer() {}
+
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+    ~StreamBuffer()
+    {
+        destroy();
+    }
+
+    /**
+     * Is persistent mapping available on this context
+     */
+    static bool supported()
+    {
+        return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+    }
+
+    /**
+     * Allocate and map three regions of bytes each
+     * @param bytes
+     * @param t
+     */
+    bool init(const GLsizeiptr& bytes, const GLenum& t = GL_ARRAY_BUFFER)
+    {
+        destroy();
+
+        target = t;
+        region_bytes = bytes;
+
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(target, buffer);
+        glBufferStorage(target, region_bytes * regions, nullptr, flags);
+        mapped = static_cast<std::uint8_t*>(
+            glMapBufferRange(target, 0, region_bytes * regions, flags));
+        glBindBuffer(target, 0);
+
+        if (mapped == nullptr)
+        {
+            std::cout << "StreamBuffer MAP ERROR\n\tCould not map " <<
+                region_bytes * regions << " bytes.\n";
+            destroy();
+
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Bytes in each region
+     */
+    GLsizeiptr capacity() const
+    {
+        return region_bytes;
+    }
+
+    /**
+     * Wait until the GPU is done with the current region and return it for writing
+     */
+    void* map()
+    {
+        TRACE_ZONE("StreamBuffer::map");
+
+        wait(region);
+
+        return mapped + region * region_bytes;
+    }
+
+    /**
+     * Byte offset of the current region in the buffer
+     */
+    GLintptr offset() const
+    {
+        return region * region_bytes;
+    }
+
+    /**
+     * Fence the current region after the draw that reads it and move to the next
+     */
+    void fence()
+    {
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region = (region + 1) % regions;
+    }
+
+private:
+    void wait(const int& r)
+    {
+        if (fences[r] == nullptr)
+            return;
+
+        // Flush on the first try so the fence is guaranteed to signal
+        GLbitfield flush = GL_SYNC_FLUSH_COMMANDS_BIT;
+
+        while (true)
+        {
+            GLenum status = glClientWaitSync(fences[r], flush, 1000000);
+
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED ||
+                status == GL_WAIT_FAILED)
+                break;
+
+            flush = 0;
+        }
+
+        glDeleteSync(fences[r]);
+        fences[r] = nullptr;
+    }
+
+    void destroy()
+    {
+        for (int r = 0; r < regions; r++)
+            wait(r);
+
+        if (mapped != nullptr)
+        {
+            glBindBuffer(target, buffer);
+            glUnmapBuffer(target);
+            glBindBuffer(target, 0);
+            mapped = nullptr;
+        }
+
+        if (buffer != 0)
+            glDeleteBuffers(1, &buffer);
+
+        buffer = 0;
+        region = 0;
+    }
+};
+
+#endif
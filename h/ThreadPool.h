@@ -0,0 +1,274 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __THREAD_POOL__
+#define __THREAD_POOL__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Trace.h"
+
+/**
+ * A fixed set of threads that split loops into chunks
+ *
+ * Each thread owns a queue of chunk indices. It takes chunks from the
+ * front of its own queue and once that is empty it steals chunks from
+ * the back of the other queues, so threads that finish early help the
+ * ones that are behind. The calling thread works too, so a pool of
+ * size 1 runs everything inline.
+ */
+class ThreadPool
+{
+    // The chunks one thread still has to run
+    struct Queue
+    {
+        std::mutex lock;
+        std::size_t front = 0;
+        std::size_t back = 0;
+    };
+
+    std::vector< std::thread > threads;
+    std::vector< std::unique_ptr< Queue > > queues;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+
+    // The loop being run, the caller's callable and a function that calls it
+    // Nothing is copied or allocated per loop
+    const void* job = nullptr;
+    void (*job_call)(const void*, std::size_t, std::size_t) = nullptr;
+    std::size_t job_count = 0;
+    std::size_t job_chunk = 0;
+    std::size_t job_chunks = 0;
+
+    std::uint64_t generation = 0;
+    std::size_t busy = 0;
+    std::atomic< std::size_t > done{0};
+    bool is_running = true;
+
+public:
+    /**
+     * Constructor
+     * @param thread_count threads including the calling thread, 0 for all cores
+     */
+    explicit ThreadPool(std::size_t thread_count = 0)
+    {
+        if (thread_count == 0)
+            thread_count = std::thread::hardware_concurrency();
+        if (thread_count == 0)
+            thread_count = 1;
+
+        for (std::size_t t = 0; t < thread_count; t++)
+            queues.emplace_back(new Queue);
+
+        for (std::size_t t = 1; t < thread_count; t++)
+            threads.emplace_back([this, t] { worker(t); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard< std::mutex > guard(lock);
+            is_running = false;
+        }
+
+        wake.notify_all();
+
+        for (auto& t : threads)
+            t.join();
+    }
+
+    /**
+     * Threads doing work, including the calling thread
+     */
+    std::size_t size() const
+    {
+        return queues.size();
+    }
+
+    /**
+     * Call fn(begin, end) for every chunk of [0, count) and wait for all of them
+     *   Chunks never straddle a multiple of chunk, so a chunk can be
+     *   identified by begin / chunk no matter which thread runs it
+     * @param count
+     * @param chunk
+     * @param fn
+     */
+    template <typename Fn>
+    void parallel_for(const std::size_t& count, const std::size_t& chunk, const Fn& fn)
+    {
+        if (count == 0)
+            return;
+
+        const std::size_t chunks = (count + chunk - 1) / chunk;
+
+        if (threads.empty() || chunks == 1)
+        {
+            for (std::size_t c = 0; c < chunks; c++)
+                fn(c * chunk, std::min(count, (c + 1) * chunk));
+
+            return;
+        }
+
+        {
+            std::lock_guard< std::mutex > guard(lock);
+
+            // The job before the chunks: a thread still leaving the last loop
+            // can pop a chunk as soon as it is queued, and the queue lock it
+            // pops under makes these visible to it
+            job = &fn;
+            job_call = [](const void* f, std::size_t begin, std::size_t end) {
+                (*static_cast< const Fn* >(f))(begin, end);
+            };
+            job_count = count;
+            job_chunk = chunk;
+            job_chunks = chunks;
+            done = 0;
+            generation++;
+
+            // Give each thread a contiguous run of chunks to start with
+            const std::size_t n = queues.size();
+
+            for (std::size_t t = 0; t < n; t++)
+            {
+                std::lock_guard< std::mutex > q(queues[t]->lock);
+                queues[t]->front = chunks * t / n;
+                queues[t]->back = chunks * (t + 1) / n;
+            }
+        }
+
+        wake.notify_all();
+
+        run_chunks(0);
+
+        // Wait until every chunk ran and no thread is still looking at this job
+        std::unique_lock< std::mutex > guard(lock);
+        finished.wait(guard, [this] { return done == job_chunks && busy == 0; });
+        job = nullptr;
+        job_call = nullptr;
+    }
+
+private:
+    bool pop(const std::size_t& t, std::size_t& c)
+    {
+        Queue& q = *queues[t];
+        std::lock_guard< std::mutex > guard(q.lock);
+
+        if (q.front == q.back)
+            return false;
+
+        c = q.front++;
+        return true;
+    }
+
+    bool steal(const std::size_t& t, std::size_t& c)
+    {
+        const std::size_t n = queues.size();
+
+        for (std::size_t i = 1; i < n; i++)
+        {
+            Queue& q = *queues[(t + i) % n];
+            std::lock_guard< std::mutex > guard(q.lock);
+
+            if (q.front == q.back)
+                continue;
+
+            c = --q.back;
+            return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * Run chunks from our own queue, then steal until there are none left
+     */
+    void run_chunks(const std::size_t& t)
+    {
+        std::size_t c;
+
+        while (pop(t, c) || steal(t, c))
+        {
+            job_call(job, c * job_chunk, std::min(job_count, (c + 1) * job_chunk));
+            done++;
+        }
+    }
+
+    void worker(const std::size_t t)
+    {
+        TRACE_THREAD("worker " + std::to_string(t));
+
+        std::uint64_t seen = 0;
+
+        while (true)
+        {
+            {
+                std::unique_lock< std::mutex > guard(lock);
+                wake.wait(guard, [&] { return !is_running || generation != seen; });
+
+                if (!is_running)
+                    return;
+
+                seen = generation;
+                busy++;
+            }
+
+            run_chunks(t);
+
+            {
+                std::lock_guard< std::mutex > guard(lock);
+                busy--;
+            }
+
+            finished.notify_one();
+        }
+    }
+};
+
+/**
+ * pool->parallel_for() when there is a pool, else the same chunks
+ * in order on the calling thread
+ * @param pool
+ * @param count
+ * @param chunk
+ * @param fn
+ */
+template <typename Fn>
+inline void parallel_for(ThreadPool* pool, const std::size_t& count, const std::size_t& chunk, const Fn& fn)
+{
+    if (pool)
+        pool->parallel_for(count, chunk, fn);
+    else
+        for (std::size_t begin = 0; begin < count; begin += chunk)
+            fn(begin, std::min(count, begin + chunk));
+}
+
+#endif
@@ -0,0 +1,277 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __TRACE__
+#define __TRACE__
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Timeline of named zones on every thread, written as Chrome trace events
+ *
+ * Build with -DPARTICLES_TRACE=ON to record, otherwise TRACE_ZONE and
+ * friends compile to nothing. Put a zone at the top of a scope:
+ *
+ *   TRACE_ZONE("Particles::updatePosition");
+ *
+ * Each thread writes its zones into its own ring of the last ring_size
+ * zones, so recording takes no lock, costs two clock reads and a few
+ * stores, and a soak test can leave it on for hours. write() saves what
+ * the rings hold as JSON for chrome://tracing or ui.perfetto.dev.
+ *
+ * Zone names must be string literals, only the pointer is kept.
+ */
+class Trace
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Zones kept per thread, a power of two
+    static constexpr std::size_t ring_size = std::size_t(1) << 16;
+
+#ifdef PARTICLES_TRACE
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    /**
+     * Record a zone from start to end on this thread
+     * @param name a string literal
+     * @param start
+     * @param end
+     */
+    static void span(const char* name, const Clock::time_point& start, const Clock::time_point& end)
+    {
+        Ring& r = ring();
+        const std::uint64_t head = r.head.load(std::memory_order_relaxed);
+        Event& e = r.events[head & (ring_size - 1)];
+
+        // write() reading any of the stores below then sees head at least
+        // where it is now, so it knows this slot is being overwritten
+        std::atomic_thread_fence(std::memory_order_release);
+
+        // Relaxed stores are plain stores, atomic only so write() can
+        // read a ring that is being written without a data race
+        e.name.store(name, std::memory_order_relaxed);
+        e.start.store(nanoseconds(start), std::memory_order_relaxed);
+        e.duration.store(static_cast<std::uint64_t>(
+            std::chrono::duration_cast< std::chrono::nanoseconds >(end - start).count()),
+            std::memory_order_relaxed);
+
+        r.head.store(head + 1, std::memory_order_release);
+    }
+
+    /**
+     * Name this thread in the timeline
+     * @param name
+     */
+    static void name_thread(const std::string& name)
+    {
+        Ring& r = ring();
+        std::lock_guard< std::mutex > guard(registry().lock);
+        r.name = name;
+    }
+
+    /**
+     * Write the zones every thread still holds to path
+     *   Threads may keep recording while this runs
+     *   Returns false when the file can not be written
+     * @param path
+     */
+    static bool write(const std::string& path)
+    {
+        if (!enabled)
+        {
+            std::cout << "Built without PARTICLES_TRACE, no trace to write\n";
+            return false;
+        }
+
+        std::ofstream out(path, std::ios::trunc);
+
+        if (!out)
+        {
+            std::cout << "Could not write the trace " << path << "\n";
+            return false;
+        }
+
+        Registry& reg = registry();
+        std::lock_guard< std::mutex > guard(reg.lock);
+
+        out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+
+        bool first = true;
+        std::vector< Copy > copies;
+
+        for (std::size_t t = 0; t < reg.rings.size(); t++)
+        {
+            const Ring& r = *reg.rings[t];
+
+            out << (first ? "" : ",\n") <<
+                "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t <<
+                ", \"args\": {\"name\": \"" << (r.name.empty() ? "thread " + std::to_string(t) : r.name) << "\"}}";
+            first = false;
+
+            // Copy the ring then drop what was overwritten while copying
+            const std::uint64_t head = r.head.load(std::memory_order_acquire);
+            const std::uint64_t begin = head > ring_size ? head - ring_size : 0;
+
+            copies.clear();
+
+            for (std::uint64_t i = begin; i < head; i++)
+            {
+                const Event& e = r.events[i & (ring_size - 1)];
+                copies.push_back({ i, e.name.load(std::memory_order_relaxed),
+                    e.start.load(std::memory_order_relaxed),
+                    e.duration.load(std::memory_order_relaxed) });
+            }
+
+            // The slot of zone after - ring_size may be half written by now
+            // so it goes too, see span()
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const std::uint64_t after = r.head.load(std::memory_order_relaxed);
+            const std::uint64_t valid = after >= ring_size ? after - ring_size + 1 : 0;
+
+            for (const Copy& c : copies)
+            {
+                if (c.index < valid || c.name == nullptr)
+                    continue;
+
+                // Microseconds with the nanoseconds after the point
+                out << ",\n{\"name\": \"" << c.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << t <<
+                    ", \"ts\": " << c.start / 1000 << "." << pad(c.start % 1000) <<
+                    ", \"dur\": " << c.duration / 1000 << "." << pad(c.duration % 1000) << "}";
+            }
+        }
+
+        out << "\n]}\n";
+
+        return static_cast<bool>(out);
+    }
+
+private:
+    struct Event
+    {
+        std::atomic< const char* > name{nullptr};
+        std::atomic< std::uint64_t > start{0};
+        std::atomic< std::uint64_t > duration{0};
+    };
+
+    struct Copy
+    {
+        std::uint64_t index;
+        const char* name;
+        std::uint64_t start;
+        std::uint64_t duration;
+    };
+
+    struct Ring
+    {
+        std::atomic< std::uint64_t > head{0};
+        std::unique_ptr< Event[] > events{new Event[ring_size]};
+        std::string name;
+    };
+
+    // Every ring ever made, kept after its thread exits so write() can read it
+    struct Registry
+    {
+        std::mutex lock;
+        std::vector< std::unique_ptr< Ring > > rings;
+        Clock::time_point epoch = Clock::now();
+    };
+
+    static Registry& registry()
+    {
+        static Registry reg;
+        return reg;
+    }
+
+    static Ring& ring()
+    {
+        thread_local Ring* r = add_ring();
+        return *r;
+    }
+
+    static Ring* add_ring()
+    {
+        Registry& reg = registry();
+        std::lock_guard< std::mutex > guard(reg.lock);
+
+        reg.rings.emplace_back(new Ring);
+
+        return reg.rings.back().get();
+    }
+
+    static std::uint64_t nanoseconds(const Clock::time_point& t)
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast< std::chrono::nanoseconds >(t - registry().epoch).count());
+    }
+
+    static std::string pad(const std::uint64_t& ns)
+    {
+        std::string s = std::to_string(ns);
+        return std::string(3 - s.size(), '0') + s;
+    }
+};
+
+/**
+ * Records the zone from its construction to the end of its scope
+ */
+class TraceZone
+{
+public:
+    explicit TraceZone(const char* zone_name) : name(zone_name), start(Trace::Clock::now()) {}
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+
+    ~TraceZone()
+    {
+        Trace::span(name, start, Trace::Clock::now());
+    }
+
+private:
+    const char* name;
+    Trace::Clock::time_point start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef PARTICLES_TRACE
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+#define TRACE_SPAN(name, start, end) Trace::span(name, start, end)
+#define TRACE_THREAD(name) Trace::name_thread(name)
+#else
+#define TRACE_ZONE(name) do {} while (0)
+#define TRACE_SPAN(name, start, end) do {} while (0)
+#define TRACE_THREAD(name) do {} while (0)
+#endif
+
+#endif
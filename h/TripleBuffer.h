@@ -0,0 +1,99 @@
+/*
+  This file is part of Particles.
+
+  fct is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  fct is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with fct.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright 2018 Zachary Young
+  */
+
+#ifndef __TRIPLE_BUFFER__
+#define __TRIPLE_BUFFER__
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Hands the latest T from one writer thread to one reader thread
+ *
+ * The writer fills write_buffer() and publish()es it, the reader
+ * acquire()s the newest published one and reads read_buffer(). Of the
+ * three slots the writer owns one, the reader owns one and the third
+ * sits in the middle, swapped in and out with a single atomic exchange.
+ * Neither side ever waits for the other and the reader always gets the
+ * newest complete T. Ones it was too slow to see are dropped.
+ */
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    /**
+     * The slot the writer fills next
+     */
+    T& write_buffer()
+    {
+        return slots[back];
+    }
+
+    /**
+     * Make the written slot the newest and take the old middle to write next
+     */
+    void publish()
+    {
+        const std::uint8_t old = middle.exchange(back | fresh, std::memory_order_acq_rel);
+        back = old & index;
+    }
+
+    /**
+     * Take the newest published slot, if there is one the reader has not seen
+     *   Returns false and keeps the current one otherwise
+     */
+    bool acquire()
+    {
+        if ((middle.load(std::memory_order_relaxed) & fresh) == 0)
+            return false;
+
+        const std::uint8_t old = middle.exchange(front, std::memory_order_acq_rel);
+        front = old & index;
+
+        return true;
+    }
+
+    /**
+     * The slot the reader took last
+     *   Stays the same until the next acquire()
+     */
+    const T& read_buffer() const
+    {
+        return slots[front];
+    }
+
+private:
+    static constexpr std::uint8_t index = 3;
+    static constexpr std::uint8_t fresh = 4;
+
+    T slots[3];
+
+    // The middle slot, with fresh set when the writer published it
+    std::atomic< std::uint8_t > middle{1};
+
+    std::uint8_t back = 0;
+    std::uint8_t front = 2;
+};
+
+#endif